@@ -16,12 +16,30 @@ BOOTORDER="bootorder-usb-sd"
 BOOT_MENU_WAIT=5000
 SCREEN_AND_DEBUG=0
 #PS2_KEYBOARD_SPINUP=500
+# Boot as soon as the first device of the bootorder file is found
+# instead of waiting for all drives (and USB) to be probed.
+#EARLY_BOOT=1
+# Boot menu wait when neither a PS/2 nor a USB keyboard is found
+# (default 0), e.g. to reach the menu over a serial console.
+#BOOT_MENU_WAIT_NOKBD=5000
+# End the boot menu wait on any key already pressed during POST.
+#BOOT_MENU_ANYKEY=1
+# Send EHCI bulk transfers one qTD at a time, as before qTD chaining
+# was added.  Set to 0 to chain qTDs once that is validated on the
+# board's EHCI controller.
+USB_EHCI_SINGLE_QTD=1
 
 INCLUDE_VGA_BIOS=vgabios.rom
 #INCLUDE_SGA_BIOS=sgabios.rom
 
 #INCLUDE_BOOTSPLASH=1
 
+# Store the floppy ramdisk as separately compressed blocks (one cylinder
+# of a 2.88 MB floppy each) so SeaBIOS can unpack any sector on its own.
+# Blocks compress slightly worse; leave empty to add the image as a
+# single lzma stream if CBFS space runs out.
+FLOPPY_BLOCK_SIZE=36864
+
 BASE_DIR=`dirname $0`
 
 (cd ${BASE_DIR} && cp config/coreboot/coreboot.config coreboot/.config) || exit 1
@@ -130,8 +148,17 @@ fi
   fi
 
   # Add floppy image as ramdisk
-  echo "Adding ramdisk floppy image"
-  cbfs_add ./msdos_2880k.img.lzma -n floppyimg/msdos_2880k.img.lzma -t raw
+  if [ -z "$FLOPPY_BLOCK_SIZE" ]; then
+    echo "Adding ramdisk floppy image"
+    cbfs_add ./msdos_2880k.img.lzma -n floppyimg/msdos_2880k.img.lzma -t raw
+  else
+    echo "Adding ramdisk floppy image (block compressed)"
+    mkdir -p out && \
+    xz --format=lzma -dc ./msdos_2880k.img.lzma > out/msdos_2880k.img && \
+    cbfs_add_blockimage out/msdos_2880k.img -n floppyimg/msdos_2880k.img \
+      -c lzma -s $FLOPPY_BLOCK_SIZE || exit 1
+    rm -f out/msdos_2880k.img
+  fi
 
   echo "Writing crossbar data..."
   ./write-crossbar.py coreboot/build/coreboot.rom crossbar/${CROSSBAR} && \
@@ -152,6 +179,22 @@ fi
     [ -z "$PS2_KEYBOARD_SPINUP" ] || \
     cbfs_add_int ${PS2_KEYBOARD_SPINUP} etc/ps2-keyboard-spinup
   ) && \
+  (
+    [ -z "$EARLY_BOOT" ] || \
+    cbfs_add_int ${EARLY_BOOT} etc/early-boot
+  ) && \
+  (
+    [ -z "$BOOT_MENU_WAIT_NOKBD" ] || \
+    cbfs_add_int ${BOOT_MENU_WAIT_NOKBD} etc/boot-menu-wait-nokbd
+  ) && \
+  (
+    [ -z "$BOOT_MENU_ANYKEY" ] || \
+    cbfs_add_int ${BOOT_MENU_ANYKEY} etc/boot-menu-anykey
+  ) && \
+  (
+    [ -z "$USB_EHCI_SINGLE_QTD" ] || \
+    cbfs_add_int ${USB_EHCI_SINGLE_QTD} etc/usb-ehci-single-qtd
+  ) && \
   (
     [ -z "$INCLUDE_VGA_BIOS" ] || \
     cbfs_add ${INCLUDE_VGA_BIOS} -n pci17f3,2200.rom -t optionrom
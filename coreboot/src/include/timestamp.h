@@ -52,6 +52,19 @@ enum timestamp_id {
 	TS_LOAD_PAYLOAD = 90,
 	TS_ACPI_WAKE_JUMP = 98,
 	TS_SELFBOOT_JUMP = 99,
+
+	/* Added by the SeaBIOS payload. */
+	TS_SEABIOS_START = 1000,
+	TS_SEABIOS_CBFS_INIT = 1001,
+	TS_SEABIOS_DEVICE_SETUP = 1002,
+	TS_SEABIOS_START_RAMDISK = 1003,
+	TS_SEABIOS_END_RAMDISK = 1004,
+	TS_SEABIOS_DEVICES_DONE = 1005,
+	TS_SEABIOS_START_OPTIONROMS = 1006,
+	TS_SEABIOS_END_OPTIONROMS = 1007,
+	TS_SEABIOS_START_BOOTMENU = 1008,
+	TS_SEABIOS_END_BOOTMENU = 1009,
+	TS_SEABIOS_BOOT = 1010,
 };
 
 #if CONFIG_COLLECT_TIMESTAMPS && (CONFIG_EARLY_CBMEM_INIT || !defined(__PRE_RAM__))
@@ -60,12 +73,14 @@ void timestamp_init(tsc_t base);
 void timestamp_add(enum timestamp_id id, tsc_t ts_time);
 void timestamp_add_now(enum timestamp_id id);
 void timestamp_reinit(void);
+void timestamp_set_base(tsc_t base);
 tsc_t get_initial_timestamp(void);
 #else
 #define timestamp_init(base)
 #define timestamp_add(id, time)
 #define timestamp_add_now(id)
 #define timestamp_reinit()
+#define timestamp_set_base(base)
 #endif
 
 #endif
@@ -25,7 +25,11 @@
 #include <arch/early_variables.h>
 #include <cpu/x86/lapic.h>
 
-#define MAX_TIMESTAMPS 30
+/* Without early CBMEM, romstage has no table to add timestamps to. */
+#if CONFIG_EARLY_CBMEM_INIT || !defined(__PRE_RAM__)
+
+/* Leaves room for the timestamps added by the payload. */
+#define MAX_TIMESTAMPS 48
 
 static struct timestamp_table* ts_table_p CAR_GLOBAL = NULL;
 static tsc_t ts_basetime CAR_GLOBAL = { .lo = 0, .hi =0 };
@@ -83,7 +87,7 @@ void timestamp_add_now(enum timestamp_id id)
 	timestamp_add(id, rdtsc());
 }
 
-#define MAX_TIMESTAMP_CACHE 8
+#define MAX_TIMESTAMP_CACHE 16
 struct timestamp_cache {
 	enum timestamp_id id;
 	tsc_t time;
@@ -163,5 +167,31 @@ void timestamp_reinit(void)
 		timestamp_do_sync();
 }
 
+#ifndef __PRE_RAM__
+/**
+ * timestamp_set_base() moves the base time back to an earlier point
+ * (eg, reset) so that timestamps recorded before ramstage, without
+ * CBMEM, can still be added to the table.
+ */
+void timestamp_set_base(tsc_t base)
+{
+	struct timestamp_table *ts_table = car_get_var(ts_table_p);
+	uint64_t new_base = tsc_to_uint64(base);
+	int i;
+
+	if (!boot_cpu())
+		return;
+
+	car_set_var(ts_basetime, base);
+	if (!ts_table)
+		return;
+	for (i = 0; i < ts_table->num_entries; i++)
+		ts_table->entries[i].entry_stamp +=
+			ts_table->base_time - new_base;
+	ts_table->base_time = new_base;
+}
+#endif
+
 /* Call timestamp_reinit at CAR migration time. */
 CAR_MIGRATE(timestamp_reinit)
+#endif
@@ -22,7 +22,9 @@
 #include <arch/io.h>
 #include <stdlib.h>
 #include <console/console.h>
+#include <arch/cpu.h>
 #include <cpu/x86/msr.h>
+#include <cpu/x86/tsc.h>
 #include "cpu/x86/mtrr/earlymtrr.c"
 #include "drivers/pc80/i8254.c"
 #include "northbridge/dmp/vortex86ex/northbridge.h"
@@ -41,6 +43,11 @@
 #define POST_DRAM_TEST_ERR 0x86
 #define POST_DRAM_SIZING_ERR 0x77
 
+/* BDA soft reset flag, set to 0x1234 by the Ctrl+Alt+Del handler. */
+#define BDA_SOFT_RESET_FLAG 0x472
+
+#include "northbridge/dmp/vortex86ex/memtest.c"
+
 static u32 get_dmp_id(void)
 {
 	return pci_read_config32(NB, NB_REG_CID);
@@ -253,9 +260,8 @@ static int verify_dram(u32 * p, u32 pattern, u32 test_len)
 	return addr - 4;	// verify error, return error address.
 }
 
-static void test_dram_stability(void)
+static void test_dram_stability(u32 test_len)
 {
-	u32 test_len = 2048 * 1024;
 	u32 pat = 0x5aa5a55a;
 	u32 ext_mem_start = 0xc0000;
 	u32 base_mem_test_len = test_len > 640 * 1024 ? 640 * 1024 : test_len;
@@ -301,6 +307,79 @@ static void test_dram_stability(void)
 	}
 }
 
+static u32 get_dram_size(void)
+{
+	/* SS = 0 for 2MB, 1 for 4MB, 2 for 8MB, 3 for 16MB ... */
+	u16 mbr = pci_read_config16(NB, NB_REG_MBR);
+	return (2 * 1024 * 1024) << ((mbr >> 8) & 0xf);
+}
+
+#if CONFIG_COLLECT_TIMESTAMPS
+/* Store the TSC in a slot of the romstage timestamp area. */
+static void romstage_ts_store(u32 slot)
+{
+	tsc_t t = rdtsc();
+	volatile u32 *p = (volatile u32 *)(get_dram_size() - ROMSTAGE_TS_SIZE);
+	p[0] = ROMSTAGE_TS_MAGIC;
+	p[1 + slot * 2] = t.lo;
+	p[2 + slot * 2] = t.hi;
+}
+#endif
+
+static int is_warm_boot(void)
+{
+	return *(volatile u16 *)BDA_SOFT_RESET_FLAG == 0x1234;
+}
+
+static int has_mtrr(void)
+{
+	return (cpuid_edx(1) >> 12) & 1;
+}
+
+/* Make DRAM write-back cacheable for the DRAM test. */
+static void dram_test_mtrr_set(void)
+{
+	msr_t msr;
+	disable_cache();
+	set_var_mtrr(0, 0x00000000, get_dram_size(), MTRR_TYPE_WRBACK);
+	msr.hi = 0;
+	msr.lo = MTRRdefTypeEn;
+	wrmsr(MTRRdefType_MSR, msr);
+	enable_cache();
+}
+
+/* Leave the MTRRs disabled, as found, for ramstage to set up. */
+static void dram_test_mtrr_clear(void)
+{
+	msr_t msr;
+	msr.hi = 0;
+	msr.lo = 0;
+	disable_cache();
+	wrmsr(MTRRdefType_MSR, msr);
+	wrmsr(MTRRphysBase_MSR(0), msr);
+	wrmsr(MTRRphysMask_MSR(0), msr);
+	enable_cache();
+}
+
+static u32 dram_test_len(void)
+{
+#if CONFIG_DRAM_TEST_FULL || CONFIG_DRAM_TEST_EXTENDED
+	u32 test_len = get_dram_size();
+#if CONFIG_DRAM_TEST_BUDGET_MB
+	if (test_len > CONFIG_DRAM_TEST_BUDGET_MB * 1024 * 1024)
+		test_len = CONFIG_DRAM_TEST_BUDGET_MB * 1024 * 1024;
+#endif
+#else
+	u32 test_len = 2048 * 1024;
+#endif
+#if CONFIG_COLLECT_TIMESTAMPS
+	/* Leave the romstage timestamps alone. */
+	if (test_len > get_dram_size() - ROMSTAGE_TS_SIZE)
+		test_len = get_dram_size() - ROMSTAGE_TS_SIZE;
+#endif
+	return test_len;
+}
+
 static void enable_l2_cache(void)
 {
 	/*
@@ -360,11 +439,39 @@ static void main(unsigned long bist)
 	pci_write_config8(NB1, 0xcc, reg_nb_f1_cc);
 
 	print_ddr3_memory_setup();
-	test_dram_stability();
+#if CONFIG_COLLECT_TIMESTAMPS
+	romstage_ts_store(ROMSTAGE_TS_AFTER_INITRAM);
+#endif
 
 	/* CPU setup, romcc pukes on invd() */
 	asm volatile ("invd");
 	enable_cache();
 
 	enable_l2_cache();
+
+	/* Test DRAM with caches already on.  ROMCC can't compile a branch
+	 * around the test, so a warm boot tests zero bytes instead.
+	 */
+#if !CONFIG_DRAM_TEST_NONE
+	u32 test_len = dram_test_len();
+#if CONFIG_DRAM_TEST_SKIP_WARM_BOOT
+	if (is_warm_boot()) {
+		print_info("Warm boot, skipping DRAM test.\n");
+		test_len = 0;
+	}
+#endif
+	if (has_mtrr())
+		dram_test_mtrr_set();
+#if CONFIG_DRAM_TEST_EXTENDED
+	memtest_run(test_len);
+#else
+	test_dram_stability(test_len);
+#endif
+	if (has_mtrr())
+		dram_test_mtrr_clear();
+#endif
+
+#if CONFIG_COLLECT_TIMESTAMPS
+	romstage_ts_store(ROMSTAGE_TS_END_ROMSTAGE);
+#endif
 }
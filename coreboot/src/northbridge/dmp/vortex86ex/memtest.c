@@ -0,0 +1,125 @@
+/*
+ * This file is part of the coreboot project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * DRAM test engine for romstage (included by the mainboard romstage.c,
+ * which runs it with caches enabled).  Memory is accessed in 32-bit
+ * words, skipping the 640KB - 768KB VGA hole.  Tests:
+ *  - data lines: walk a one through a single word,
+ *  - walking ones: word N holds 1 << (N % 32), over all memory,
+ *  - address in address: each word holds its address, then its inverse,
+ *  - moving inversions: fill with a pattern, check and invert all words
+ *    upwards, then check and invert them back downwards.
+ * The first error is reported with address, expected and read value
+ * and the XOR of both (the failing bits), then the system halts.
+ *
+ * ROMCC inlines every call, so the tests share one fill/check loop and
+ * one error report to keep the romstage small enough to compile.
+ */
+
+#define MEMTEST_BASE_END	(640 * 1024)
+#define MEMTEST_EXT_START	0xc0000
+
+#define MEMTEST_WALKING_ONES	0
+#define MEMTEST_ADDRESS		1
+#define MEMTEST_ADDRESS_INV	2
+#define MEMTEST_PASSES		3
+
+static u32 memtest_next(u32 addr)
+{
+	return addr + 4 == MEMTEST_BASE_END ? MEMTEST_EXT_START : addr + 4;
+}
+
+static u32 memtest_prev(u32 addr)
+{
+	return addr == MEMTEST_EXT_START ? MEMTEST_BASE_END - 4 : addr - 4;
+}
+
+static u32 memtest_pattern(u32 pass, u32 addr)
+{
+	return pass == MEMTEST_WALKING_ONES ? 1 << ((addr >> 2) & 31) :
+	       pass == MEMTEST_ADDRESS ? addr : ~addr;
+}
+
+static void memtest_fail(u32 addr, u32 expect)
+{
+	u32 r = *(volatile u32 *)addr;
+	post_code(POST_DRAM_TEST_ERR);
+	print_emerg("DRAM test error!\nADDR = ");
+	print_emerg_hex32(addr);
+	print_emerg(", WRITE = ");
+	print_emerg_hex32(expect);
+	print_emerg(", READ = ");
+	print_emerg_hex32(r);
+	print_emerg(", XOR = ");
+	print_emerg_hex32(r ^ expect);
+	print_emerg("\n");
+	die("System halted.\n");
+}
+
+/* Test the first test_len bytes of DRAM. */
+static void memtest_run(u32 test_len)
+{
+	u32 pass, addr, bit;
+	u32 pat = 0x55555555;
+
+	if (test_len > MEMTEST_BASE_END && test_len <= MEMTEST_EXT_START)
+		test_len = MEMTEST_BASE_END;
+	if (test_len > MEMTEST_EXT_START) {
+		/* Enable all shadow RAM region C0000 - FFFFF. */
+		pci_write_config32(NB, NB_REG_MAR, 0x3ffffff0);
+	}
+
+	print_debug("DRAM test: data lines\n");
+	for (bit = 1; bit && test_len; bit <<= 1) {
+		*(volatile u32 *)0 = bit;
+		/* Drive the inverse on the bus before reading back. */
+		*(volatile u32 *)4 = ~bit;
+		if (*(volatile u32 *)0 != bit)
+			memtest_fail(0, bit);
+	}
+
+	print_debug("DRAM test: walking ones, address in address\n");
+	for (pass = 0; pass < MEMTEST_PASSES; pass++) {
+		for (addr = 0; addr < test_len; addr = memtest_next(addr))
+			*(volatile u32 *)addr = memtest_pattern(pass, addr);
+		for (addr = 0; addr < test_len; addr = memtest_next(addr))
+			if (*(volatile u32 *)addr != memtest_pattern(pass, addr))
+				memtest_fail(addr, memtest_pattern(pass, addr));
+	}
+
+	print_debug("DRAM test: moving inversions\n");
+	for (addr = 0; addr < test_len; addr = memtest_next(addr))
+		*(volatile u32 *)addr = pat;
+	for (addr = 0; addr < test_len; addr = memtest_next(addr)) {
+		if (*(volatile u32 *)addr != pat)
+			memtest_fail(addr, pat);
+		*(volatile u32 *)addr = ~pat;
+	}
+	for (addr = test_len; addr > 0;) {
+		addr = memtest_prev(addr);
+		if (*(volatile u32 *)addr != ~pat)
+			memtest_fail(addr, ~pat);
+		*(volatile u32 *)addr = pat;
+	}
+
+	if (test_len > MEMTEST_EXT_START) {
+		/* Disable shadow RAM. */
+		pci_write_config32(NB, NB_REG_MAR, 0x0);
+	}
+	print_debug("DRAM test passed.\n");
+}
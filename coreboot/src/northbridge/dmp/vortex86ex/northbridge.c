@@ -25,14 +25,44 @@
 #include <device/pci_ids.h>
 #include <cbmem.h>
 #include <pc80/mc146818rtc.h>
+#include <timestamp.h>
 #include "chip.h"
 #include "northbridge.h"
 
 #define SPI_BASE 0xfc00
 
+#if CONFIG_COLLECT_TIMESTAMPS
+/* Pick up the timestamps romstage left at the top of DRAM. */
+static void import_romstage_timestamps(device_t dev)
+{
+	u32 *p;
+	tsc_t ts;
+	int ss;
+
+	ss = (pci_read_config16(dev, NB_REG_MBR) >> 8) & 0xf;
+	p = (u32 *)(((2UL * 1024 * 1024) << ss) - ROMSTAGE_TS_SIZE);
+	if (p[0] != ROMSTAGE_TS_MAGIC)
+		return;
+
+	/* Romstage stamps are relative to reset, not to ramstage entry. */
+	ts.lo = ts.hi = 0;
+	timestamp_set_base(ts);
+	ts.lo = p[1 + ROMSTAGE_TS_AFTER_INITRAM * 2];
+	ts.hi = p[2 + ROMSTAGE_TS_AFTER_INITRAM * 2];
+	timestamp_add(TS_AFTER_INITRAM, ts);
+	ts.lo = p[1 + ROMSTAGE_TS_END_ROMSTAGE * 2];
+	ts.hi = p[2 + ROMSTAGE_TS_END_ROMSTAGE * 2];
+	timestamp_add(TS_END_ROMSTAGE, ts);
+	p[0] = 0;
+}
+#endif
+
 static void northbridge_init(device_t dev)
 {
 	printk(BIOS_DEBUG, "Vortex86EX northbridge early init ...\n");
+#if CONFIG_COLLECT_TIMESTAMPS
+	import_romstage_timestamps(dev);
+#endif
 	// enable F0A/ECA/E8A/E4A/E0A/C4A/C0A shadow read/writable.
 	pci_write_config32(dev, NB_REG_MAR, 0x3ff000f0);
 	// enable C0000h - C3FFFh/C4000h - C7FFF can be in L1 cache selection.
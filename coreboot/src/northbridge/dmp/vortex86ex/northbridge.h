@@ -66,4 +66,14 @@
 #define NB1_REG_UPDATE_PHY_IO	0xf8
 #define NB1_REG_RESET_DRAMC_PHY	0xfa
 
+/*
+ * The ROMCC romstage can't use CBMEM, so it leaves its timestamps in the
+ * last 4KB of DRAM (which the DRAM test skips) for ramstage to pick up:
+ * magic, then (tsc low, tsc high) for each slot below.
+ */
+#define ROMSTAGE_TS_SIZE	4096
+#define ROMSTAGE_TS_MAGIC	0x53544d52	/* "RMTS" */
+#define ROMSTAGE_TS_AFTER_INITRAM	0
+#define ROMSTAGE_TS_END_ROMSTAGE	1
+
 #endif				/* NORTHBRIDGE_H */
@@ -0,0 +1,101 @@
+/*
+ * cbfs-mkblockimage
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA, 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "cbfs.h"
+
+static int is_zero(const char *data, uint32_t len)
+{
+	uint32_t i;
+	for (i = 0; i < len; i++)
+		if (data[i])
+			return 0;
+	return 1;
+}
+
+int parse_raw_to_blockimage(const struct buffer *input,
+			    struct buffer *output,
+			    comp_algo algo,
+			    uint32_t block_size)
+{
+	comp_func_ptr compress;
+	struct cbfs_blockimage *bimg;
+	uint32_t block_count, doffset, i;
+	uint32_t holes = 0, stored = 0;
+
+	compress = compression_function(algo);
+	if (!compress)
+		return -1;
+
+	if (block_size == 0)
+		block_size = CBFS_BLOCKIMAGE_DEFAULT_BLOCK_SIZE;
+	if (input->size == 0) {
+		ERROR("Block image input is empty.\n");
+		return -1;
+	}
+
+	DEBUG("start: parse_raw_to_blockimage\n");
+	block_count = (input->size + block_size - 1) / block_size;
+	doffset = sizeof(*bimg) + (block_count + 1) * sizeof(uint32_t);
+	/* Blocks are never stored larger than their uncompressed size. */
+	if (buffer_create(output, doffset + input->size, input->name) != 0)
+		return -1;
+	memset(output->data, 0, output->size);
+
+	bimg = (struct cbfs_blockimage *)output->data;
+	bimg->magic = htonl(CBFS_BLOCKIMAGE_MAGIC);
+	bimg->compression = htonl(algo);
+	bimg->size = htonl(input->size);
+	bimg->block_size = htonl(block_size);
+	bimg->block_count = htonl(block_count);
+
+	for (i = 0; i < block_count; i++) {
+		char *in = input->data + i * block_size;
+		int in_len = input->size - i * block_size;
+		int len;
+
+		if (in_len > (int)block_size)
+			in_len = block_size;
+		bimg->offsets[i] = htonl(doffset);
+
+		if (is_zero(in, in_len)) {
+			holes++;
+			continue;
+		}
+
+		len = in_len;
+		compress(in, in_len, output->data + doffset, &len);
+		if (len >= in_len) {
+			/* Compression didn't help - store it as is. */
+			len = in_len;
+			memcpy(output->data + doffset, in, in_len);
+			stored++;
+		}
+		doffset += len;
+	}
+	bimg->offsets[block_count] = htonl(doffset);
+	output->size = doffset;
+
+	INFO("Block image: %d blocks of %d bytes (%d empty, %d uncompressed), "
+	     "%zd -> %zd bytes\n", block_count, block_size, holes, stored,
+	     input->size, output->size);
+	return 0;
+}
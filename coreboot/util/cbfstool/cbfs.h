@@ -79,6 +79,25 @@ struct cbfs_payload {
 	struct cbfs_payload_segment segments;
 } __attribute__ ((packed));
 
+/* A block image holds data split into fixed size blocks that are
+ * compressed separately, so any block can be read without decompressing
+ * the others.  offsets[] has block_count + 1 entries relative to the
+ * start of the header; block i is stored in offsets[i]..offsets[i+1].
+ * An empty block is all zeros and a block stored with its full size is
+ * not compressed. */
+#define CBFS_BLOCKIMAGE_MAGIC	0x42494d47 /* BIMG */
+
+struct cbfs_blockimage {
+	uint32_t magic;
+	uint32_t compression;
+	uint32_t size;
+	uint32_t block_size;
+	uint32_t block_count;
+	uint32_t offsets[0];
+} __attribute__ ((packed));
+
+#define CBFS_BLOCKIMAGE_DEFAULT_BLOCK_SIZE (16 * 1024)
+
 /** These are standard component types for well known
     components (i.e - those that coreboot needs to consume.
     Users are welcome to use any other value for their
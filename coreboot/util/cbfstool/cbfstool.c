@@ -229,6 +229,18 @@ static int cbfstool_convert_mkflatpayload(struct buffer *buffer,
 	return 0;
 }
 
+static int cbfstool_convert_mkblockimage(struct buffer *buffer,
+					 uint32_t *offset) {
+	struct buffer output;
+	if (parse_raw_to_blockimage(buffer, &output, param.algo,
+				    param.size) != 0)
+		return -1;
+	buffer_delete(buffer);
+	// direct assign, no dupe.
+	memcpy(buffer, &output, sizeof(*buffer));
+	return 0;
+}
+
 
 static int cbfs_add(void)
 {
@@ -280,6 +292,16 @@ static int cbfs_add_flat_binary(void)
 				  cbfstool_convert_mkflatpayload);
 }
 
+static int cbfs_add_blockimage(void)
+{
+	return cbfs_add_component(param.cbfs_name,
+				  param.filename,
+				  param.name,
+				  param.type ? param.type : CBFS_COMPONENT_RAW,
+				  param.baseaddress,
+				  cbfstool_convert_mkblockimage);
+}
+
 static int cbfs_add_integer(void)
 {
 	return cbfs_add_integer_component(param.cbfs_name,
@@ -514,6 +536,7 @@ static const struct command commands[] = {
 	{"add-stage", "f:n:t:c:b:vh?", cbfs_add_stage},
 	{"add-flat-binary", "f:n:l:e:c:b:vh?", cbfs_add_flat_binary},
 	{"add-int", "i:n:b:vh?", cbfs_add_integer},
+	{"add-blockimage", "f:n:t:c:s:b:vh?", cbfs_add_blockimage},
 	{"remove", "n:vh?", cbfs_remove},
 	{"create", "s:B:b:H:a:o:m:vh?", cbfs_create},
 	{"locate", "f:n:P:a:Tvh?", cbfs_locate},
@@ -568,6 +591,9 @@ static void usage(char *name)
 			"Add a 32bit flat mode binary\n"
 	     " add-int -i INTEGER -n NAME [-b base]                        "
 			"Add a raw 64-bit integer value\n"
+	     " add-blockimage -f FILE -n NAME [-t TYPE] [-c compression] \\\n"
+	     "        [-s block-size] [-b base]                            "
+			"Add a randomly accessible block compressed image\n"
 	     " remove -n NAME                                              "
 			"Remove a component\n"
 	     " create -s size -B bootblock -m ARCH [-a align] [-o offset]  "
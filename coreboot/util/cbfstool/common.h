@@ -110,6 +110,11 @@ int parse_flat_binary_to_payload(const struct buffer *input,
 				 uint32_t loadaddress,
 				 uint32_t entrypoint,
 				 comp_algo algo);
+/* cbfs-mkblockimage.c */
+int parse_raw_to_blockimage(const struct buffer *input,
+			    struct buffer *output,
+			    comp_algo algo,
+			    uint32_t block_size);
 /* cbfs-mkstage.c */
 int parse_elf_to_stage(const struct buffer *input, struct buffer *output,
 		       comp_algo algo, uint32_t *location);
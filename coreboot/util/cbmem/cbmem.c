@@ -275,6 +275,52 @@ static void print_norm(u64 v, int comma)
 		printf(",");
 }
 
+static const struct timestamp_id_to_name {
+	u32 id;
+	const char *name;
+} timestamp_ids[] = {
+	{ TS_START_ROMSTAGE,		"start of romstage" },
+	{ TS_BEFORE_INITRAM,		"before ram initialization" },
+	{ TS_AFTER_INITRAM,		"after ram initialization" },
+	{ TS_END_ROMSTAGE,		"end of romstage" },
+	{ TS_START_VBOOT,		"start of verified boot" },
+	{ TS_END_VBOOT,			"end of verified boot" },
+	{ TS_START_COPYRAM,		"start of copying ram stage" },
+	{ TS_END_COPYRAM,		"end of copying ram stage" },
+	{ TS_START_RAMSTAGE,		"start of ramstage" },
+	{ TS_DEVICE_ENUMERATE,		"device enumeration" },
+	{ TS_DEVICE_CONFIGURE,		"device configuration" },
+	{ TS_DEVICE_ENABLE,		"device enable" },
+	{ TS_DEVICE_INITIALIZE,		"device initialization" },
+	{ TS_DEVICE_DONE,		"device setup done" },
+	{ TS_CBMEM_POST,		"cbmem post" },
+	{ TS_WRITE_TABLES,		"write tables" },
+	{ TS_LOAD_PAYLOAD,		"load payload" },
+	{ TS_ACPI_WAKE_JUMP,		"ACPI wake jump" },
+	{ TS_SELFBOOT_JUMP,		"selfboot jump" },
+	{ TS_SEABIOS_START,		"SeaBIOS start" },
+	{ TS_SEABIOS_CBFS_INIT,		"SeaBIOS CBFS scanned" },
+	{ TS_SEABIOS_DEVICE_SETUP,	"SeaBIOS device setup" },
+	{ TS_SEABIOS_START_RAMDISK,	"SeaBIOS start of ramdisk load" },
+	{ TS_SEABIOS_END_RAMDISK,	"SeaBIOS end of ramdisk load" },
+	{ TS_SEABIOS_DEVICES_DONE,	"SeaBIOS devices ready" },
+	{ TS_SEABIOS_START_OPTIONROMS,	"SeaBIOS start of option roms" },
+	{ TS_SEABIOS_END_OPTIONROMS,	"SeaBIOS end of option roms" },
+	{ TS_SEABIOS_START_BOOTMENU,	"SeaBIOS start of boot menu" },
+	{ TS_SEABIOS_END_BOOTMENU,	"SeaBIOS end of boot menu" },
+	{ TS_SEABIOS_BOOT,		"SeaBIOS boot" },
+};
+
+static const char *timestamp_name(u32 id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(timestamp_ids); i++)
+		if (timestamp_ids[i].id == id)
+			return timestamp_ids[i].name;
+	return "";
+}
+
 /* dump the timestamp table */
 static void dump_timestamps(void)
 {
@@ -294,7 +340,8 @@ static void dump_timestamps(void)
 	for (i = 0; i < tst_p->num_entries; i++) {
 		const struct timestamp_entry *tse_p = tst_p->entries + i;
 
-		printf("%4d:", tse_p->entry_id);
+		printf("%4d:%-32s", tse_p->entry_id,
+		       timestamp_name(tse_p->entry_id));
 		print_norm(tse_p->entry_stamp / cpu_freq_MHz, 0);
 		if (i) {
 			printf(" (");
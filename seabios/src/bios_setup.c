@@ -1,10 +1,12 @@
 #include "bregs.h"   // struct bregs
 #include "config.h"  // SEG_BIOS
 #include "farptr.h"  // FLATPTR_TO_SEG, FLATPTR_TO_OFFSET
+#include "malloc.h"  // malloc_tmp
 #include "output.h"  // dprintf
 #include "stacks.h"  // call16_int
 #include "string.h"  // memset
 #include "util.h"
+#include "x86.h"     // writew
 #include "bios_fonts.h"
 
 #define BLACK         0x00
@@ -32,6 +34,8 @@
 #define ACTIVE_TEXT       YELLOW
 #define POPUP_BACKGROUND  LIGHT_GRAY
 
+// Fixed offsets of the settings in the BIOS settings page, as written
+// by older versions.  Only read if the settings log has no record.
 #define INITIALIZED_OFFSET            0xC0
 #define CPU_FREQ_INDEX_OFFSET         0xC1
 #define CACHE_ENABLED_OFFSET          0xC2
@@ -95,6 +99,15 @@ const char *com_desc[] = {
     "you 115200 baud, 57600 (divider 2) at 48 MHz / 16 turns into 1.5 Mbaud."
 };
 
+const char disk_write_cache_title[] = "Disk Write Cache";
+void set_disk_write_cache_value(struct bios_settings *s, int value) { s->disk_write_cache = value; }
+const char *disk_write_cache_desc[] = {
+    "Merges small disk writes, which makes writing to USB sticks and CF",
+    "cards much faster. Uses " __stringify(CONFIG_DISK_WRITE_CACHE_SIZE)
+    " KB of DOS memory for the write buffer.",
+    "Data written within the last second is lost if the power is cut."
+};
+
 // Disabled this for now - no use in the TinyLlama.
 //
 // const char isa_freq_title[] = "ISA Bus Frequency";
@@ -125,7 +138,7 @@ const u8 clock_array[7][6] = {
 };
 
 int selection = 0;
-const int max_selection = 4;
+const int max_selection = 5;
 
 void reboot(void)
 {
@@ -135,83 +148,451 @@ void reboot(void)
     farcall16big(&br);
 }
 
-void save_settings(struct bios_settings *s)
+
+/****************************************************************
+ * Settings log
+ ****************************************************************/
+
+// Settings are stored as an append-only log of records in the pages of
+// the last flash sector that come before the crossbar page.  A save
+// appends one record and only erases the sector once the log is full
+// (or the clock straps in the BIOS settings page change).  The record
+// of each type with the highest sequence number wins.
+#define SETTINGS_LOG_MAGIC   0x4c53 // "SL"
+#define SETTINGS_LOG_PAYLOAD 20
+#define SETTINGS_LOG_TYPES   4
+
+#define SETTINGS_RECORD_BIOS     1
+#define SETTINGS_RECORD_PRESENCE 2
+
+struct settings_record {
+    u16 magic;
+    u8 type;
+    u8 len;
+    u32 seq;
+    u8 data[SETTINGS_LOG_PAYLOAD];
+    u32 crc;
+} PACKED;
+
+// Payload of a SETTINGS_RECORD_BIOS record.  Only append fields - a
+// shorter record from an older version leaves the rest at defaults.
+struct bios_settings_record {
+    u8 cpu_freq_index;
+    u8 cache_enabled;
+    u8 boot_tune;
+    u8 com1_clock_index;
+    u8 com1_clock_ratio_index;
+    u8 com2_clock_index;
+    u8 com2_clock_ratio_index;
+    u8 disk_write_cache;
+} PACKED;
+
+static int settings_log_scanned = 0;
+static u32 settings_log_seq = 0;
+static int settings_log_next = 0; // first unused slot
+static struct settings_record settings_log_newest[SETTINGS_LOG_TYPES];
+
+static u32 settings_log_slots(void)
+{
+    return (spi_crossbar_offset - spi_sector_offset)
+        / sizeof(struct settings_record);
+}
+
+static u32 settings_log_addr(int slot)
+{
+    return spi_sector_offset + slot * sizeof(struct settings_record);
+}
+
+static u32 crc32(const u8 *buf, u32 len)
 {
+    u32 crc = ~0;
     int i;
+    while (len--) {
+        crc ^= *buf++;
+        for (i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static int settings_record_valid(struct settings_record *r)
+{
+    return r->magic == SETTINGS_LOG_MAGIC && r->type < SETTINGS_LOG_TYPES
+        && r->len <= SETTINGS_LOG_PAYLOAD
+        && r->crc == crc32((u8*)r, offsetof(struct settings_record, crc));
+}
+
+static int settings_record_blank(struct settings_record *r)
+{
+    u8 *p = (u8*)r;
+    int i;
+    for (i = 0; i < sizeof(*r); i++)
+        if (p[i] != 0xFF)
+            return 0;
+    return 1;
+}
+
+// Find the newest record of each type and the end of the log.
+static void settings_log_scan(void)
+{
+    if (settings_log_scanned)
+        return;
+    settings_log_scanned = 1;
+    memset(settings_log_newest, 0, sizeof(settings_log_newest));
+    settings_log_seq = 0;
+    settings_log_next = 0;
+
+    struct settings_record r;
+    int slot, count = settings_log_slots();
+    for (slot = 0; slot < count; slot++) {
+        spi_flash_read_mapped(settings_log_addr(slot), (u8*)&r, sizeof(r));
+        // Compaction writes the records back in type order, so the end
+        // of the log is the last used slot, not the newest record.
+        if (!settings_record_blank(&r))
+            settings_log_next = slot + 1;
+        if (!settings_record_valid(&r))
+            continue;
+        struct settings_record *newest = &settings_log_newest[r.type];
+        if (newest->magic != SETTINGS_LOG_MAGIC || r.seq > newest->seq)
+            *newest = r;
+        if (r.seq > settings_log_seq)
+            settings_log_seq = r.seq;
+    }
+    dprintf(3, "Settings log: sequence %d, next slot %d of %d\n"
+            , settings_log_seq, settings_log_next, count);
+}
+
+// Return the payload length of the newest record of 'type' (or -1).
+static int settings_log_read(int type, void *data, int len)
+{
+    settings_log_scan();
+    struct settings_record *r = &settings_log_newest[type];
+    if (r->magic != SETTINGS_LOG_MAGIC)
+        return -1;
+    if (len > r->len)
+        len = r->len;
+    memcpy(data, r->data, len);
+    return r->len;
+}
+
+// Program a record into the next slot if it is still erased.
+static int settings_log_append(struct settings_record *r)
+{
+    struct settings_record old;
+    if (settings_log_next >= settings_log_slots())
+        return -1;
+    // Check the flash itself - the mapped window may be cached.
+    u32 addr = settings_log_addr(settings_log_next);
+    spi_flash_read(addr, (u8*)&old, sizeof(old));
+    if (!settings_record_blank(&old))
+        return -1;
+    if (spi_flash_program_page(addr, (u8*)r, sizeof(*r)))
+        return -1;
+    settings_log_next++;
+    return 0;
+}
+
+// Erase the sector and write back the crossbar page, the BIOS settings
+// page and the newest record of each type.
+static void settings_log_compact(const u8 *bios_settings)
+{
     u8 crossbar[spi_page_size];
+    int type;
+
+    dprintf(1, "Reading crossbar page\n");
+    spi_flash_read(spi_crossbar_offset, crossbar, spi_page_size);
+
+    dprintf(1, "Erasing sector\n");
+    if (spi_flash_erase_sector(spi_sector_offset)) {
+        dprintf(1, "Sector erase failed\n");
+        return;
+    }
+
+    dprintf(1, "Writing back crossbar page\n");
+    spi_flash_program_page(spi_crossbar_offset, crossbar, spi_page_size);
+
+    dprintf(1, "Writing back BIOS settings page\n");
+    spi_flash_program_page(spi_bios_settings_offset, bios_settings, spi_page_size);
+
+    settings_log_next = 0;
+    for (type = 0; type < SETTINGS_LOG_TYPES; type++) {
+        struct settings_record *r = &settings_log_newest[type];
+        if (r->magic == SETTINGS_LOG_MAGIC)
+            settings_log_append(r);
+    }
+}
+
+// Make 'data' the newest record of 'type'.
+static struct settings_record *
+settings_log_record(int type, const void *data, int len)
+{
+    settings_log_scan();
+    struct settings_record *r = &settings_log_newest[type];
+    memset(r, 0, sizeof(*r));
+    r->magic = SETTINGS_LOG_MAGIC;
+    r->type = type;
+    r->len = len;
+    r->seq = ++settings_log_seq;
+    memcpy(r->data, data, len);
+    r->crc = crc32((u8*)r, offsetof(struct settings_record, crc));
+    return r;
+}
+
+// Add a new record of 'type' without ever erasing the sector, for
+// writes the user didn't ask for.  If the log is full the record is
+// only kept in memory, and the next compaction writes it out.
+static void settings_log_add(int type, const void *data, int len)
+{
+    struct settings_record *r = settings_log_record(type, data, len);
+    if (settings_log_append(r))
+        dprintf(1, "Settings log full - record not written\n");
+}
+
+// Add a new record of 'type'.  'bios_settings' is the BIOS settings
+// page if it has to be rewritten (which requires an erase).
+static void settings_log_write(int type, const void *data, int len
+                               , const u8 *bios_settings)
+{
+    struct settings_record *r = settings_log_record(type, data, len);
+    if (!bios_settings && !settings_log_append(r))
+        return;
+
+    u8 page[spi_page_size];
+    if (!bios_settings) {
+        spi_flash_read(spi_bios_settings_offset, page, spi_page_size);
+        bios_settings = page;
+    }
+    settings_log_compact(bios_settings);
+}
+
+void save_settings(struct bios_settings *s)
+{
     u8 bios_settings[spi_page_size];
+    struct bios_settings_record rec;
+    const u8 *clock = clock_array[s->cpu_freq_index];
 
     if (get_spi_flash_info() == 0) {
         dprintf(1, "Aborting");
         return;
     }
-    dprintf(1, "Reading crossbar page\n");
-    for (i = 0; i < spi_page_size; i++) {
-        crossbar[i] = spi_flash_read_byte(spi_crossbar_offset + i);
-    }
 
+    // The clock straps have to stay at their fixed offsets in the BIOS
+    // settings page, so only changing them requires an erase.  Read
+    // the flash itself - the mapped window may still show the page
+    // from before an earlier save during this boot.
     dprintf(1, "Reading BIOS settings page\n");
-    for (i = 0; i < spi_page_size; i++) {
-        bios_settings[i] = spi_flash_read_byte(spi_bios_settings_offset + i);
+    spi_flash_read(spi_bios_settings_offset, bios_settings, spi_page_size);
+    int straps_changed = (bios_settings[0xB6] != clock[0]
+                          || bios_settings[0xB7] != clock[1]
+                          || bios_settings[0xBB] != clock[2]
+                          || bios_settings[0xBC] != clock[3]
+                          || bios_settings[0xBD] != clock[4]
+                          || bios_settings[0xBF] != clock[5]);
+    if (straps_changed) {
+        dprintf(1, "Modifying BIOS settings page\n");
+        bios_settings[0xB6] = clock[0];
+        bios_settings[0xB7] = clock[1];
+        bios_settings[0xBB] = clock[2];
+        bios_settings[0xBC] = clock[3];
+        bios_settings[0xBD] = clock[4];
+        bios_settings[0xBF] = clock[5];
     }
 
-    dprintf(1, "Modifying BIOS settings page\n");
-    bios_settings[0xB6] = clock_array[s->cpu_freq_index][0];
-    bios_settings[0xB7] = clock_array[s->cpu_freq_index][1];
-    bios_settings[0xBB] = clock_array[s->cpu_freq_index][2];
-    bios_settings[0xBC] = clock_array[s->cpu_freq_index][3];
-    bios_settings[0xBD] = clock_array[s->cpu_freq_index][4];
-    bios_settings[0xBF] = clock_array[s->cpu_freq_index][5];
-
-    bios_settings[INITIALIZED_OFFSET]            = 1;
-    bios_settings[CPU_FREQ_INDEX_OFFSET]         = (u8)s->cpu_freq_index;
-    bios_settings[CACHE_ENABLED_OFFSET]          = (u8)s->cache_enabled;
-    bios_settings[BOOT_TUNE_OFFSET]              = (u8)s->boot_tune;
-    bios_settings[COM1_CLOCK_INDEX_OFFSET]       = (u8)s->com1_clock_index;
-    bios_settings[COM1_CLOCK_RATIO_INDEX_OFFSET] = (u8)s->com1_clock_ratio_index;
-    bios_settings[COM2_CLOCK_INDEX_OFFSET]       = (u8)s->com2_clock_index;
-    bios_settings[COM2_CLOCK_RATIO_INDEX_OFFSET] = (u8)s->com2_clock_ratio_index;
-    //bios_settings[ISA_FREQ_INDEX_OFFSET]         = (u8)s->isa_freq_index;
+    memset(&rec, 0, sizeof(rec));
+    rec.cpu_freq_index         = (u8)s->cpu_freq_index;
+    rec.cache_enabled          = (u8)s->cache_enabled;
+    rec.boot_tune              = (u8)s->boot_tune;
+    rec.com1_clock_index       = (u8)s->com1_clock_index;
+    rec.com1_clock_ratio_index = (u8)s->com1_clock_ratio_index;
+    rec.com2_clock_index       = (u8)s->com2_clock_index;
+    rec.com2_clock_ratio_index = (u8)s->com2_clock_ratio_index;
+    rec.disk_write_cache       = (u8)s->disk_write_cache;
+    //rec.isa_freq_index         = (u8)s->isa_freq_index;
+
+    dprintf(1, "Writing settings record\n");
+    settings_log_write(SETTINGS_RECORD_BIOS, &rec, sizeof(rec)
+                       , straps_changed ? bios_settings : NULL);
+}
 
-    dprintf(1, "Erasing sector\n");
-    spi_flash_erase_sector(spi_sector_offset);
+static void default_bios_settings(struct bios_settings *s)
+{
+    s->has_changes = 0;
+    s->cpu_freq_index = 3; // 300 MHz
+    s->cache_enabled = 1;
+    s->boot_tune = 1;
+    s->com1_clock_index = 0;
+    s->com1_clock_ratio_index = 0;
+    s->com2_clock_index = 0;
+    s->com2_clock_ratio_index = 0;
+    s->disk_write_cache = 0;
+    // s->isa_freq_index = 0;
+}
 
-    dprintf(1, "Writing back crossbar page\n");
-    for (i = 0; i < spi_page_size; i++) {
-        spi_flash_write_byte(spi_crossbar_offset + i, crossbar[i]);
-    }
+// Load the settings stored at fixed offsets by older versions.
+static int load_legacy_bios_settings(struct bios_settings *s)
+{
+    u8 settings[COM2_CLOCK_RATIO_INDEX_OFFSET - INITIALIZED_OFFSET + 1];
+    spi_flash_read_mapped(spi_bios_settings_offset + INITIALIZED_OFFSET, settings, sizeof(settings));
+#define SETTING(offset) ((int)settings[(offset) - INITIALIZED_OFFSET])
+    if (SETTING(INITIALIZED_OFFSET) != 1)
+        return -1;
+    s->cpu_freq_index = SETTING(CPU_FREQ_INDEX_OFFSET);
+    s->cache_enabled = SETTING(CACHE_ENABLED_OFFSET);
+    s->boot_tune = SETTING(BOOT_TUNE_OFFSET);
+    s->com1_clock_index = SETTING(COM1_CLOCK_INDEX_OFFSET);
+    s->com1_clock_ratio_index = SETTING(COM1_CLOCK_RATIO_INDEX_OFFSET);
+    s->com2_clock_index = SETTING(COM2_CLOCK_INDEX_OFFSET);
+    s->com2_clock_ratio_index = SETTING(COM2_CLOCK_RATIO_INDEX_OFFSET);
+    // s->isa_freq_index = SETTING(ISA_FREQ_INDEX_OFFSET);
+#undef SETTING
+    return 0;
+}
 
-    dprintf(1, "Writing back BIOS settings page\n");
-    for (i = 0; i < spi_page_size; i++) {
-        spi_flash_write_byte(spi_bios_settings_offset + i, bios_settings[i]);
+void load_bios_settings(struct bios_settings *s)
+{
+    struct bios_settings_record rec;
+
+    default_bios_settings(s);
+    int len = settings_log_read(SETTINGS_RECORD_BIOS, &rec, sizeof(rec));
+    if (len < 0) {
+        if (load_legacy_bios_settings(s))
+            save_settings(s);
+        return;
     }
+
+#define FIELD(f) (len >= offsetof(struct bios_settings_record, f) + 1)
+    if (FIELD(cpu_freq_index) && rec.cpu_freq_index < cpu_freq_values_length)
+        s->cpu_freq_index = rec.cpu_freq_index;
+    if (FIELD(cache_enabled))
+        s->cache_enabled = rec.cache_enabled;
+    if (FIELD(boot_tune))
+        s->boot_tune = rec.boot_tune;
+    if (FIELD(com1_clock_index))
+        s->com1_clock_index = rec.com1_clock_index;
+    if (FIELD(com1_clock_ratio_index))
+        s->com1_clock_ratio_index = rec.com1_clock_ratio_index;
+    if (FIELD(com2_clock_index))
+        s->com2_clock_index = rec.com2_clock_index;
+    if (FIELD(com2_clock_ratio_index))
+        s->com2_clock_ratio_index = rec.com2_clock_ratio_index;
+    if (FIELD(disk_write_cache))
+        s->disk_write_cache = rec.disk_write_cache;
+#undef FIELD
 }
 
-void load_bios_settings(struct bios_settings *s)
+
+/****************************************************************
+ * Device presence cache
+ ****************************************************************/
+
+// The drives and USB root ports that had a device on the last boot are
+// kept in a SETTINGS_RECORD_PRESENCE record.  Ports that were empty are
+// probed with short timeouts.  If the devices found don't match the
+// record, a record asking for a full scan is written so the next boot
+// doesn't trust a possibly incomplete short probe.
+#define PRESENCE_USB_CNTLS 4
+#define PRESENCE_RESCAN    0x01
+
+struct presence_record {
+    u8 flags;
+    u8 ata;     // bit chanid*2+slave
+    struct {
+        u16 bdf;
+        u16 ports;
+    } PACKED usb[PRESENCE_USB_CNTLS];
+} PACKED;
+
+static struct presence_record PresenceLast, PresenceFound;
+static int PresenceValid, PresenceRescan;
+
+void presence_load(void)
+{
+    memset(&PresenceFound, 0, sizeof(PresenceFound));
+    memset(&PresenceLast, 0, sizeof(PresenceLast));
+    int len = settings_log_read(SETTINGS_RECORD_PRESENCE, &PresenceLast
+                                , sizeof(PresenceLast));
+    // Presence records are never written to a full log, so the cache
+    // may be out of date until the user saves the settings again.
+    PresenceValid = (len == sizeof(PresenceLast)
+                     && !(PresenceLast.flags & PRESENCE_RESCAN)
+                     && settings_log_next < settings_log_slots());
+    dprintf(1, "Device presence cache %s\n", PresenceValid ? "loaded" : "not used");
+}
+
+// Return 0 if the last boot found no device (-1 if unknown).
+int presence_ata(int chanid, int slave)
+{
+    int bit = chanid * 2 + slave;
+    if (!PresenceValid || bit >= 8)
+        return -1;
+    return !!(PresenceLast.ata & (1 << bit));
+}
+
+void presence_ata_found(int chanid, int slave)
+{
+    int bit = chanid * 2 + slave;
+    if (bit < 8)
+        PresenceFound.ata |= 1 << bit;
+}
+
+static int presence_usb_index(struct presence_record *r, u16 bdf)
+{
+    int i;
+    for (i = 0; i < PRESENCE_USB_CNTLS; i++)
+        if (r->usb[i].bdf == bdf && r->usb[i].ports)
+            return i;
+    return -1;
+}
+
+int presence_usb(u16 bdf, int port)
+{
+    if (!PresenceValid || port >= 16)
+        return -1;
+    int i = presence_usb_index(&PresenceLast, bdf);
+    return i >= 0 && PresenceLast.usb[i].ports & (1 << port);
+}
+
+void presence_usb_found(u16 bdf, int port)
 {
-    int initialized = (int)spi_flash_read_byte(spi_bios_settings_offset + INITIALIZED_OFFSET) == 1 ? 1 : 0;
-    if (!initialized) {
-        s->has_changes = 0;
-        s->cpu_freq_index = 3; // 300 MHz
-        s->cache_enabled = 1;
-        s->boot_tune = 1;
-        s->com1_clock_index = 0;
-        s->com1_clock_ratio_index = 0;
-        s->com2_clock_index = 0;
-        s->com2_clock_ratio_index = 0;
-        // s->isa_freq_index = 0;
-        save_settings(s);
-    } else {
-        s->has_changes = 0;
-        s->cpu_freq_index = (int)spi_flash_read_byte(spi_bios_settings_offset + CPU_FREQ_INDEX_OFFSET);
-        s->cache_enabled = (int)spi_flash_read_byte(spi_bios_settings_offset + CACHE_ENABLED_OFFSET);
-        s->boot_tune = (int)spi_flash_read_byte(spi_bios_settings_offset + BOOT_TUNE_OFFSET);
-        s->com1_clock_index = (int)spi_flash_read_byte(spi_bios_settings_offset + COM1_CLOCK_INDEX_OFFSET);
-        s->com1_clock_ratio_index = (int)spi_flash_read_byte(spi_bios_settings_offset + COM1_CLOCK_RATIO_INDEX_OFFSET);
-        s->com2_clock_index = (int)spi_flash_read_byte(spi_bios_settings_offset + COM2_CLOCK_INDEX_OFFSET);
-        s->com2_clock_ratio_index = (int)spi_flash_read_byte(spi_bios_settings_offset + COM2_CLOCK_RATIO_INDEX_OFFSET);
-        // s->isa_freq_index = (int)spi_flash_read_byte(spi_bios_settings_offset + ISA_FREQ_INDEX_OFFSET);
+    if (port >= 16)
+        return;
+    int i = presence_usb_index(&PresenceFound, bdf);
+    if (i < 0) {
+        // Allocate a free slot.
+        for (i = 0; i < PRESENCE_USB_CNTLS; i++)
+            if (!PresenceFound.usb[i].ports)
+                break;
+        if (i >= PRESENCE_USB_CNTLS)
+            return;
+        PresenceFound.usb[i].bdf = bdf;
     }
+    PresenceFound.usb[i].ports |= 1 << port;
+}
+
+// A short probe timed out instead of finding the port empty - the
+// next boot has to do a full scan even if nothing else changed.
+void presence_rescan(void)
+{
+    PresenceRescan = 1;
+}
+
+// Record the devices found by a complete probe.
+void presence_save(void)
+{
+    if (!PresenceRescan
+        && memcmp(&PresenceFound, &PresenceLast, sizeof(PresenceFound)) == 0)
+        return;
+    if (PresenceValid || PresenceRescan)
+        // Ports may have been skipped by a short probe - scan all next time.
+        PresenceFound.flags |= PRESENCE_RESCAN;
+    if (get_spi_flash_info() == 0)
+        return;
+    // Only append - an erase during POST could lose the BIOS settings
+    // page, which holds the reset vector.
+    dprintf(1, "Writing device presence record\n");
+    settings_log_add(SETTINGS_RECORD_PRESENCE, &PresenceFound
+                     , sizeof(PresenceFound));
+    PresenceLast = PresenceFound;
 }
 
 u32 get_current_cpu_freq(void)
@@ -230,7 +611,26 @@ u32 get_current_cpu_freq(void)
     return (25L * cns) / (cms * (1L << crs) * (cdiv + 2L));
 }
 
-void set_cursor_position(u8 row, u8 col)
+/****************************************************************
+ * Screen buffer
+ ****************************************************************/
+
+// The setup screen is composed in a back buffer and screen_flush() only
+// copies the cells that changed into the text mode frame buffer, which
+// is much faster than an int 0x10 call per string, especially at the
+// lower cpu frequencies.  If the buffers can't be allocated everything
+// goes through int 0x10 as before.
+#define SCREEN_ROWS  25
+#define SCREEN_COLS  80
+#define SCREEN_CELLS (SCREEN_ROWS * SCREEN_COLS)
+#define SCREEN_ADDR  0xB8000 // color text mode, page 0
+
+static u16 *screen_back;  // what should be on screen
+static u16 *screen_front; // what was last written to the frame buffer
+static u8 screen_row, screen_col;
+static u8 cursor_row, cursor_col; // hardware cursor position
+
+static void bios_set_cursor_position(u8 row, u8 col)
 {
     struct bregs br;
     memset(&br, 0, sizeof(br));
@@ -241,9 +641,76 @@ void set_cursor_position(u8 row, u8 col)
     call16_int(0x10, &br);
 }
 
+static void screen_alloc(void)
+{
+    screen_back = malloc_tmp(SCREEN_CELLS * sizeof(u16));
+    screen_front = malloc_tmp(SCREEN_CELLS * sizeof(u16));
+    if (!screen_back || !screen_front) {
+        dprintf(1, "No memory for setup screen buffer\n");
+        free(screen_back);
+        free(screen_front);
+        screen_back = screen_front = NULL;
+        return;
+    }
+    memset(screen_back, 0, SCREEN_CELLS * sizeof(u16));
+    // Nothing is known about the frame buffer yet - redraw every cell.
+    memset(screen_front, 0xff, SCREEN_CELLS * sizeof(u16));
+    screen_row = screen_col = 0;
+    cursor_row = cursor_col = 0xff;
+}
+
+static void screen_free(void)
+{
+    free(screen_back);
+    free(screen_front);
+    screen_back = screen_front = NULL;
+}
+
+static void screen_fill(u8 row, u8 col, u16 cell, u16 count)
+{
+    u32 pos = row * SCREEN_COLS + col;
+    while (count-- && pos < SCREEN_CELLS)
+        screen_back[pos++] = cell;
+}
+
+// Copy the dirty cells to the frame buffer and move the cursor.
+static void screen_flush(void)
+{
+    if (!screen_back)
+        return;
+    u16 *fb = (void*)SCREEN_ADDR;
+    int i;
+    for (i = 0; i < SCREEN_CELLS; i++) {
+        u16 cell = screen_back[i];
+        if (cell != screen_front[i]) {
+            writew(&fb[i], cell);
+            screen_front[i] = cell;
+        }
+    }
+    if (screen_row != cursor_row || screen_col != cursor_col) {
+        bios_set_cursor_position(screen_row, screen_col);
+        cursor_row = screen_row;
+        cursor_col = screen_col;
+    }
+}
+
+void set_cursor_position(u8 row, u8 col)
+{
+    if (!screen_back) {
+        bios_set_cursor_position(row, col);
+        return;
+    }
+    screen_row = row;
+    screen_col = col;
+}
+
 // color: high 4 bits = background, low 4 bits = foreground
 void print_color_char(const char c, u8 color, u16 repeat)
 {
+    if (screen_back) {
+        screen_fill(screen_row, screen_col, (u8)c | (color << 8), repeat);
+        return;
+    }
     struct bregs br;
     memset(&br, 0, sizeof(br));
     br.flags = F_IF;
@@ -257,6 +724,12 @@ void print_color_char(const char c, u8 color, u16 repeat)
 // color: high 4 bits = background, low 4 bits = foreground
 void print_color_string(const char *str, u16 length, u8 color, u8 row, u8 col)
 {
+    if (screen_back) {
+        u32 pos = row * SCREEN_COLS + col;
+        while (length-- && pos < SCREEN_CELLS)
+            screen_back[pos++] = (u8)*str++ | (color << 8);
+        return;
+    }
     struct bregs br;
     memset(&br, 0, sizeof(br));
     br.flags = F_IF;
@@ -275,6 +748,10 @@ void print_color_string(const char *str, u16 length, u8 color, u8 row, u8 col)
 // color: high 4 bits = background, low 4 bits = foreground
 void clear_screen(u8 color)
 {
+    if (screen_back) {
+        screen_fill(0, 0, ' ' | (color << 8), SCREEN_CELLS);
+        return;
+    }
     struct bregs br;
     memset(&br, 0, sizeof(br));
     br.flags = F_IF;
@@ -479,6 +956,11 @@ void draw_menu_items(void)
     u16 boot_tune_length = strlen(boot_tune);
     u8 boot_tune_row = 12;
 
+    char disk_write_cache[cap];
+    snprintf(disk_write_cache, cap, "%s", disk_write_cache_title);
+    u16 disk_write_cache_length = strlen(disk_write_cache);
+    u8 disk_write_cache_row = 14;
+
     u8 active_color = COLOR(PASSIVE_TEXT, ACTIVE_BACKGROUND);
     u8 passive_color = COLOR(ACTIVE_TEXT, BACKGROUND);
 
@@ -488,6 +970,7 @@ void draw_menu_items(void)
     print_color_string(com1, com1_length, selection == 2 ? active_color : passive_color, com1_row, std_col);
     print_color_string(com2, com2_length, selection == 3 ? active_color : passive_color, com2_row, std_col);
     print_color_string(boot_tune, boot_tune_length, selection == 4 ? active_color : passive_color, boot_tune_row, std_col);
+    print_color_string(disk_write_cache, disk_write_cache_length, selection == 5 ? active_color : passive_color, disk_write_cache_row, std_col);
 
     u8 color = COLOR(PASSIVE_TEXT, BACKGROUND);
     set_cursor_position(21, 1);
@@ -513,9 +996,12 @@ void draw_menu_items(void)
             desc = com_desc;
             break;
         case 4:
-        default:
             desc = boot_tune_desc;
             break;
+        case 5:
+        default:
+            desc = disk_write_cache_desc;
+            break;
     }
     for (i = 0; i < 3; i++) {
         char d[80];
@@ -563,12 +1049,18 @@ void draw_settings(struct bios_settings *s)
     u16 boot_tune_length = strlen(boot_tune);
     u8 boot_tune_row = 12;
 
+    char disk_write_cache[cap];
+    snprintf(disk_write_cache, cap, "%s: %s", disk_write_cache_title, enabled_disabled_values[s->disk_write_cache]);
+    u16 disk_write_cache_length = strlen(disk_write_cache);
+    u8 disk_write_cache_row = 14;
+
     print_color_string(cpu_freq, cpu_freq_length, color, cpu_freq_row, std_col);
     print_color_string(cache, cache_length, color, cache_row, std_col);
     // print_color_string(isa_freq, isa_freq_length, color, isa_freq_row, std_col);
     print_color_string(com1, com1_length, color, com1_row, std_col);
     print_color_string(com2, com2_length, color, com2_row, std_col);
     print_color_string(boot_tune, boot_tune_length, color, boot_tune_row, std_col);
+    print_color_string(disk_write_cache, disk_write_cache_length, color, disk_write_cache_row, std_col);
 }
 
 void draw_description(int only_clear, const char **description_lines)
@@ -733,12 +1225,20 @@ void change_setting(struct bios_settings *s)
             values = boot_tune_values;
             change_function = &set_boot_tune_value;
             break;
+        case 5:
+            setting_selection = s->disk_write_cache;
+            title = disk_write_cache_title;
+            number_of_values = enabled_disabled_values_length;
+            values = enabled_disabled_values;
+            change_function = &set_disk_write_cache_value;
+            break;
         default:
             return;
     }
 
     for (;;) {
         draw_popup(title, number_of_values, values, setting_selection);
+        screen_flush();
         int scancode = get_keystroke_full(1000);
         if (scancode == -1) continue;
         switch (scancode >> 8) {
@@ -795,6 +1295,7 @@ void bios_setup_loop(struct bios_settings *s)
             draw_settings(s);
             set_cursor_position(25, 0);
         }
+        screen_flush();
         int scancode = get_keystroke_full(1000);
         if (scancode == -1) continue;
         switch (scancode >> 8) {
@@ -843,8 +1344,11 @@ void bios_setup_main(struct bios_settings *s)
     load_custom_fonts(bios_fonts+bios_font_D0_pos, 0xD0, 1);
     load_custom_fonts(bios_fonts+bios_font_D2_pos, 0xD2, 7);
     load_custom_fonts(bios_fonts+bios_font_E0_pos, 0xE0, 2);
+    screen_alloc();
     bios_setup_loop(s);
     clear_screen(COLOR(LIGHT_GRAY, BLACK));
+    screen_flush();
+    screen_free();
     load_custom_fonts(VGA8_F16+bios_font_D0_pos, 0xD0, 1);
     load_custom_fonts(VGA8_F16+bios_font_D2_pos, 0xD2, 7);
     load_custom_fonts(VGA8_F16+bios_font_E0_pos, 0xE0, 2);
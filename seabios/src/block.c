@@ -14,6 +14,7 @@
 #include "hw/rtc.h" // rtc_read
 #include "hw/virtio-blk.h" // process_virtio_blk_op
 #include "malloc.h" // malloc_low
+#include "memmap.h" // add_e820
 #include "output.h" // dprintf
 #include "stacks.h" // stack_hop
 #include "std/disk.h" // struct dpte_s
@@ -463,6 +464,198 @@ fill_edd(u16 seg, struct int13dpt_s *param_far, struct drive_s *drive_gf)
 }
 
 
+/****************************************************************
+ * Read cache
+ ****************************************************************/
+
+// Sectors per cache line - a miss reads the whole aligned line.
+#define DISK_CACHE_LINE 16
+#define DISK_CACHE_LINE_SIZE (DISK_CACHE_LINE * DISK_SECTOR_SIZE)
+// Returned when a request should go to the driver.
+#define DISK_CACHE_MISS -1
+#define DISK_CACHE_NOCALL -2
+
+struct disk_cache_line_s {
+    struct drive_s *drive_gf; // NULL if unused
+    u64 lba;
+    u32 lru;
+    u16 count;
+    u8 *data;
+};
+
+struct disk_cache_line_s *DiskCache VARFSEG;
+int DiskCacheLines VARFSEG;
+u32 DiskCacheLru VARLOW;
+// Set if a request bypassed the cache without invalidating it.
+u8 DiskCacheStale VARLOW;
+
+void
+disk_cache_setup(void)
+{
+    ASSERT32FLAT();
+    if (!CONFIG_DISK_CACHE)
+        return;
+    int lines = CONFIG_DISK_CACHE_SIZE * 1024 / DISK_CACHE_LINE_SIZE;
+    if (!lines)
+        return;
+    // The cache is too big for ZoneHigh - take it from ZoneTmpHigh and
+    // reserve it in the e820 map, like the ramdisk image.
+    u32 size = ALIGN(lines * (DISK_CACHE_LINE_SIZE + sizeof(*DiskCache))
+                     , PAGE_SIZE);
+    u8 *data = memalign_tmphigh(PAGE_SIZE, size);
+    if (!data) {
+        warn_noalloc();
+        return;
+    }
+    add_e820((u32)data, size, E820_RESERVED);
+    struct disk_cache_line_s *cache = (void*)&data[
+        lines * DISK_CACHE_LINE_SIZE];
+    memset(cache, 0, lines * sizeof(*cache));
+    int i;
+    for (i = 0; i < lines; i++)
+        cache[i].data = data + i * DISK_CACHE_LINE_SIZE;
+    DiskCache = cache;
+    DiskCacheLines = lines;
+    dprintf(1, "Disk read cache of %d KB at %p\n"
+            , lines * DISK_CACHE_LINE_SIZE / 1024, data);
+}
+
+static int
+disk_cache_type(u8 type)
+{
+    switch (type) {
+    case DTYPE_ATA:
+    case DTYPE_AHCI:
+    case DTYPE_USB:
+    case DTYPE_USB_32:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Drop the cached sectors of a drive that overlap 'lba'..'lba+count'.
+static void
+disk_cache_invalidate(struct drive_s *drive_gf, u64 lba, u64 count)
+{
+    int i;
+    for (i = 0; i < DiskCacheLines; i++) {
+        struct disk_cache_line_s *line = &DiskCache[i];
+        if (line->drive_gf && (!drive_gf || line->drive_gf == drive_gf)
+            && line->lba < lba + count && lba < line->lba + line->count)
+            line->drive_gf = NULL;
+    }
+}
+
+// Send a request to the driver from 32bit mode.
+static int
+disk_cache_driver_op(struct disk_op_s *op)
+{
+    switch (op->drive_gf->type) {
+    case DTYPE_ATA:
+        return process_ata_op(op);
+    case DTYPE_AHCI:
+        return process_ahci_op(op);
+    default:
+        return process_scsi_op(op);
+    }
+}
+
+// Find the cache line holding the sectors starting at 'lba' (which is
+// line aligned), reading them from the drive if needed.
+static struct disk_cache_line_s *
+disk_cache_lookup(struct drive_s *drive_gf, u64 lba)
+{
+    struct disk_cache_line_s *line, *victim = DiskCache;
+    int i;
+    for (i = 0; i < DiskCacheLines; i++) {
+        line = &DiskCache[i];
+        if (line->drive_gf == drive_gf && line->lba == lba) {
+            line->lru = ++DiskCacheLru;
+            return line;
+        }
+        if (!line->drive_gf || (victim->drive_gf && line->lru < victim->lru))
+            victim = line;
+    }
+
+    u64 sectors = drive_gf->sectors;
+    if (sectors && lba >= sectors)
+        return NULL;
+    struct disk_op_s dop;
+    memset(&dop, 0, sizeof(dop));
+    dop.drive_gf = drive_gf;
+    dop.command = CMD_READ;
+    dop.lba = lba;
+    dop.buf_fl = victim->data;
+    dop.count = DISK_CACHE_LINE;
+    if (sectors && sectors - lba < DISK_CACHE_LINE)
+        dop.count = sectors - lba;
+    u16 count = dop.count;
+    victim->drive_gf = NULL;
+    int ret = disk_cache_driver_op(&dop);
+    if (ret || dop.count != count)
+        return NULL;
+    victim->drive_gf = drive_gf;
+    victim->lba = lba;
+    victim->count = count;
+    victim->lru = ++DiskCacheLru;
+    return victim;
+}
+
+static int
+disk_cache_read(struct disk_op_s *op)
+{
+    struct drive_s *drive_gf = op->drive_gf;
+    if (op->count >= DISK_CACHE_LINE || drive_gf->blksize != DISK_SECTOR_SIZE)
+        // Large reads gain nothing from the cache.
+        return DISK_CACHE_MISS;
+
+    u16 done = 0;
+    while (done < op->count) {
+        u64 lba = op->lba + done;
+        u32 offset = (u32)lba % DISK_CACHE_LINE;
+        struct disk_cache_line_s *line = disk_cache_lookup(
+            drive_gf, lba - offset);
+        if (!line || offset >= line->count)
+            return DISK_CACHE_MISS;
+        u16 count = line->count - offset;
+        if (count > op->count - done)
+            count = op->count - done;
+        memcpy(op->buf_fl + done * DISK_SECTOR_SIZE
+               , line->data + offset * DISK_SECTOR_SIZE
+               , count * DISK_SECTOR_SIZE);
+        done += count;
+    }
+    return DISK_RET_SUCCESS;
+}
+
+// Satisfy a read from the cache or invalidate the sectors a request
+// modifies.  Returns DISK_CACHE_MISS if the driver still has to run.
+int VISIBLE32FLAT
+disk_cache_op(struct disk_op_s *op)
+{
+    if (!CONFIG_DISK_CACHE)
+        return DISK_CACHE_MISS;
+    if (DiskCacheStale) {
+        disk_cache_invalidate(NULL, 0, (u64)-1);
+        DiskCacheStale = 0;
+    }
+    switch (op->command) {
+    case CMD_READ:
+        return disk_cache_read(op);
+    case CMD_WRITE:
+        disk_cache_invalidate(op->drive_gf, op->lba, op->count);
+        return DISK_CACHE_MISS;
+    case CMD_FORMAT:
+    case CMD_RESET:
+        disk_cache_invalidate(op->drive_gf, 0, (u64)-1);
+        return DISK_CACHE_MISS;
+    default:
+        return DISK_CACHE_MISS;
+    }
+}
+
+
 /****************************************************************
  * 16bit calling interface
  ****************************************************************/
@@ -498,13 +691,24 @@ process_atapi_op(struct disk_op_s *op)
     }
 }
 
-// Execute a disk_op request.
-int
-process_op(struct disk_op_s *op)
+// Send a disk_op request to the cache and driver.
+static int
+__process_op(struct disk_op_s *op)
 {
     ASSERT16();
     int ret, origcount = op->count;
     u8 type = GET_GLOBALFLAT(op->drive_gf->type);
+    if (CONFIG_DISK_CACHE && GET_GLOBAL(DiskCacheLines)
+        && disk_cache_type(type)) {
+        extern void _cfunc32flat_disk_cache_op(void);
+        ret = call32(_cfunc32flat_disk_cache_op
+                     , (u32)MAKE_FLATPTR(GET_SEG(SS), op), DISK_CACHE_NOCALL);
+        if (ret == DISK_RET_SUCCESS)
+            return ret;
+        if (ret == DISK_CACHE_NOCALL)
+            // Can't reach the cache (vm86 mode) - drop it once possible.
+            SET_LOW(DiskCacheStale, 1);
+    }
     switch (type) {
     case DTYPE_FLOPPY:
         ret = process_floppy_op(op);
@@ -559,6 +763,191 @@ process_op(struct disk_op_s *op)
     return ret;
 }
 
+// Small writes to the drives the read cache handles can be held back
+// and merged with the writes that follow them, so that DOS writing a
+// file a sector at a time doesn't cost a flash program cycle per sector
+// on USB sticks and CF cards.  The pending sectors are written once the
+// buffer is full, a request depends on them, a drive is reset, the
+// system boots, or they are older than DISK_WRITE_DELAY.
+#define DISK_WRITE_DELAY 1000 // ms
+#define DISK_WRITE_PASS -1
+
+u8 *DiskWriteBuf VARFSEG;
+u16 DiskWriteMax VARFSEG;
+struct drive_s *DiskWriteDrive VARLOW; // NULL if nothing is pending
+u64 DiskWriteLba VARLOW;
+u16 DiskWriteCount VARLOW;
+u32 DiskWriteTime VARLOW;
+// Nesting depth of process_op() - a flush from an interrupt handler
+// must not re-enter a driver in the middle of a request.
+u8 DiskOpBusy VARLOW;
+
+void
+disk_write_cache_setup(int enabled)
+{
+    ASSERT32FLAT();
+    if (!CONFIG_DISK_WRITE_CACHE || !enabled)
+        return;
+    u16 max = CONFIG_DISK_WRITE_CACHE_SIZE * 1024 / DISK_SECTOR_SIZE;
+    u8 *buf = malloc_low(max * DISK_SECTOR_SIZE);
+    if (!max || !buf) {
+        warn_noalloc();
+        return;
+    }
+    DiskWriteBuf = buf;
+    DiskWriteMax = max;
+    dprintf(1, "Disk write coalescing with %d KB buffer\n"
+            , CONFIG_DISK_WRITE_CACHE_SIZE);
+}
+
+// Write the pending sectors to their drive.
+static int
+disk_write_flush(void)
+{
+    struct drive_s *drive_gf = GET_LOW(DiskWriteDrive);
+    if (!drive_gf)
+        return DISK_RET_SUCCESS;
+    SET_LOW(DiskWriteDrive, NULL);
+    struct disk_op_s dop;
+    memset(&dop, 0, sizeof(dop));
+    dop.drive_gf = drive_gf;
+    dop.command = CMD_WRITE;
+    dop.lba = GET_LOW(DiskWriteLba);
+    dop.count = GET_LOW(DiskWriteCount);
+    dop.buf_fl = GET_GLOBAL(DiskWriteBuf);
+    int ret;
+    if (MODE16) {
+        ret = __process_op(&dop);
+    } else {
+        disk_cache_op(&dop);
+        ret = disk_cache_driver_op(&dop);
+    }
+    if (ret)
+        dprintf(1, "Delayed write of %d sectors at %d failed (%x)\n"
+                , GET_LOW(DiskWriteCount), (u32)GET_LOW(DiskWriteLba), ret);
+    return ret;
+}
+
+// Add a write to the pending sectors if it overlaps or extends them.
+static int
+disk_write_merge(struct disk_op_s *op)
+{
+    u64 lba = GET_LOW(DiskWriteLba);
+    u16 count = GET_LOW(DiskWriteCount);
+    if (GET_LOW(DiskWriteDrive) != op->drive_gf
+        || op->lba < lba || op->lba > lba + count
+        || op->lba + op->count > lba + GET_GLOBAL(DiskWriteMax))
+        return -1;
+    u32 offset = op->lba - lba;
+    memcpy_fl(GET_GLOBAL(DiskWriteBuf) + offset * DISK_SECTOR_SIZE
+              , op->buf_fl, op->count * DISK_SECTOR_SIZE);
+    if (offset + op->count > count)
+        SET_LOW(DiskWriteCount, offset + op->count);
+    return 0;
+}
+
+// Hold back a write until the buffer is full.
+static int
+disk_write_queue(struct disk_op_s *op, int flush)
+{
+    int ret;
+    if (flush || !GET_LOW(DiskWriteDrive) || disk_write_merge(op)) {
+        ret = disk_write_flush();
+        if (ret)
+            goto fail;
+        SET_LOW(DiskWriteLba, op->lba);
+        SET_LOW(DiskWriteCount, 0);
+        SET_LOW(DiskWriteTime, irqtimer_calc(DISK_WRITE_DELAY));
+        SET_LOW(DiskWriteDrive, op->drive_gf);
+        disk_write_merge(op);
+    }
+    if (GET_LOW(DiskWriteCount) < GET_GLOBAL(DiskWriteMax))
+        return DISK_RET_SUCCESS;
+    ret = disk_write_flush();
+    if (ret)
+        goto fail;
+    return DISK_RET_SUCCESS;
+fail:
+    op->count = 0;
+    return ret;
+}
+
+// Hold back a write or flush the pending sectors if a request depends
+// on them.  Returns DISK_WRITE_PASS if the request still has to be sent.
+static int
+disk_write_op(struct disk_op_s *op)
+{
+    struct drive_s *drive_gf = op->drive_gf;
+    struct drive_s *pending = GET_LOW(DiskWriteDrive);
+    u64 lba = GET_LOW(DiskWriteLba);
+    u16 count = GET_LOW(DiskWriteCount);
+    int flush = pending && irqtimer_check(GET_LOW(DiskWriteTime));
+    switch (op->command) {
+    case CMD_WRITE:
+        if (op->count && op->count < GET_GLOBAL(DiskWriteMax)
+            && disk_cache_type(GET_GLOBALFLAT(drive_gf->type))
+            && GET_GLOBALFLAT(drive_gf->blksize) == DISK_SECTOR_SIZE)
+            return disk_write_queue(op, flush);
+        flush |= pending == drive_gf;
+        break;
+    case CMD_READ:
+    case CMD_VERIFY:
+        flush |= (pending == drive_gf
+                  && op->lba < lba + count && lba < op->lba + op->count);
+        break;
+    case CMD_RESET:
+        flush |= pending != NULL;
+        break;
+    default:
+        flush |= pending == drive_gf;
+        break;
+    }
+    if (flush) {
+        int ret = disk_write_flush();
+        if (ret) {
+            op->count = 0;
+            return ret;
+        }
+    }
+    return DISK_WRITE_PASS;
+}
+
+// Write back pending sectors whose delay expired - called while the
+// system is idle waiting for keyboard input.
+void
+disk_write_idle(void)
+{
+    ASSERT16();
+    if (!CONFIG_DISK_WRITE_CACHE || !GET_LOW(DiskWriteDrive)
+        || GET_LOW(DiskOpBusy) || !irqtimer_check(GET_LOW(DiskWriteTime)))
+        return;
+    stack_hop(0, 0, disk_write_flush);
+}
+
+// Write back pending sectors before booting.
+void
+disk_write_cache_flush(void)
+{
+    ASSERT32FLAT();
+    if (CONFIG_DISK_WRITE_CACHE)
+        disk_write_flush();
+}
+
+// Execute a disk_op request.
+int
+process_op(struct disk_op_s *op)
+{
+    ASSERT16();
+    if (!CONFIG_DISK_WRITE_CACHE || !GET_GLOBAL(DiskWriteBuf))
+        return __process_op(op);
+    SET_LOW(DiskOpBusy, GET_LOW(DiskOpBusy) + 1);
+    int ret = disk_write_op(op);
+    if (ret == DISK_WRITE_PASS)
+        ret = __process_op(op);
+    SET_LOW(DiskOpBusy, GET_LOW(DiskOpBusy) - 1);
+    return ret;
+}
+
 // Execute a "disk_op_s" request - this runs on the extra stack.
 static int
 __send_disk_op(struct disk_op_s *op_far, u16 op_seg)
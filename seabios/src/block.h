@@ -101,8 +101,13 @@ void map_hd_drive(struct drive_s *drive);
 void map_cd_drive(struct drive_s *drive);
 struct int13dpt_s;
 int fill_edd(u16 seg, struct int13dpt_s *param_far, struct drive_s *drive_gf);
+int process_scsi_op(struct disk_op_s *op);
+void disk_write_cache_setup(int enabled);
+void disk_write_idle(void);
+void disk_write_cache_flush(void);
 int process_op(struct disk_op_s *op);
 int send_disk_op(struct disk_op_s *op);
 int create_bounce_buf(void);
+void disk_cache_setup(void);
 
 #endif // block.h
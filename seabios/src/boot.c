@@ -10,8 +10,10 @@
 #include "config.h" // CONFIG_*
 #include "fw/paravirt.h" // qemu_cfg_show_boot_menu
 #include "hw/pci.h" // pci_bdf_to_*
+#include "hw/ps2port.h" // has_ps2_keyboard
 #include "hw/rtc.h" // rtc_read
 #include "hw/usb.h" // struct usbdevice_s
+#include "hw/usb-hid.h" // usb_kbd_active
 #include "list.h" // hlist_node
 #include "malloc.h" // free
 #include "output.h" // dprintf
@@ -242,6 +244,7 @@ int bootprio_find_usb(struct usbdevice_s *usbdev, int lun)
 
 static int BootRetryTime;
 static int CheckFloppySig = 1;
+static int BootEarly;
 
 #define DEFAULT_PRIO           9999
 
@@ -278,6 +281,7 @@ boot_init(void)
     }
 
     BootRetryTime = romfile_loadint("etc/boot-fail-wait", 60*1000);
+    BootEarly = romfile_loadint("etc/early-boot", 0);
 
     loadBootOrder();
 }
@@ -299,6 +303,7 @@ struct bootentry_s {
     struct hlist_node node;
 };
 static struct hlist_head BootList VARVERIFY32INIT;
+static int BootFirstFound;
 
 #define IPL_TYPE_FLOPPY      0x01
 #define IPL_TYPE_HARDDISK    0x02
@@ -324,6 +329,9 @@ bootentry_add(int type, int prio, u32 data, const char *desc)
     be->description = desc ?: "?";
     dprintf(3, "Registering bootable: %s (type:%d prio:%d data:%x)\n"
             , be->description, type, prio, data);
+    if (prio == 1)
+        // The first entry of the bootorder file.
+        BootFirstFound = 1;
 
     // Add entry in sorted order.
     struct hlist_node **pprev;
@@ -399,6 +407,47 @@ boot_add_cbfs(void *data, const char *desc, int prio)
 }
 
 
+/****************************************************************
+ * Early boot
+ ****************************************************************/
+
+#define SETUP_MENU_KEY 0x3B // F1
+#define BOOT_MENU_KEY  0x86 // F12
+
+// With "etc/early-boot" set, POST stops waiting for the device probes
+// as soon as the device named first in the bootorder file is found, so
+// booting from it doesn't wait on USB enumeration timeouts.  The probes
+// still running notice this through boot_probe_abandoned() and give up.
+static int BootProbesAbandoned;
+static int BootEarlyKey = -1;
+
+int
+boot_probe_abandoned(void)
+{
+    return BootProbesAbandoned;
+}
+
+// Wait for the device probes started by device_hardware_setup().
+void
+boot_wait_probes(void)
+{
+    while (have_other_threads()) {
+        if (BootEarly && BootFirstFound && !BootProbesAbandoned) {
+            // A menu key pressed by now means the user wants to choose.
+            int scan_code = get_keystroke(0);
+            if (scan_code == SETUP_MENU_KEY || scan_code == BOOT_MENU_KEY) {
+                BootEarlyKey = scan_code;
+                BootEarly = 0;
+            } else {
+                dprintf(1, "Boot device found - abandoning remaining probes\n");
+                BootProbesAbandoned = 1;
+            }
+        }
+        yield();
+    }
+}
+
+
 /****************************************************************
  * Boot menu and BCV execution
  ****************************************************************/
@@ -429,12 +478,6 @@ interactive_bootmenu(void)
 
     load_custom_fonts(VGA8_F16, 0x00, 256);
 
-    if (s.boot_tune == 1) {
-        play_mushroom_tune();
-    } else if (s.boot_tune == 2) {
-        play_ducks_tune();
-    }
-
     // Set SBCLK
     outl(0x800038c0, 0x0cf8);
     u32 c0 = inl(0x0cfc);
@@ -486,20 +529,37 @@ interactive_bootmenu(void)
     }
     printf("%lu MB\n", (unsigned long int)ram_size_mb);
 
-    while (get_keystroke(0) >= 0);
+    // Keys pressed during POST are normally discarded.  With
+    // etc/boot-menu-anykey they end the wait right away instead (or
+    // open the menu if one of them was F1 or F12).
+    int anykey = romfile_loadint("etc/boot-menu-anykey", 0);
+    int post_key = -1, key;
+    while ((key = get_keystroke(0)) >= 0)
+        if (post_key != SETUP_MENU_KEY && post_key != BOOT_MENU_KEY)
+            post_key = key;
 
-    int setup_menu_key = 0x3B; // F1
-    int boot_menu_key = 0x86;  // F12
     printf("\nPress F1 for setup, F12 for boot menu\n");
 
     u32 menu_time = romfile_loadint("etc/boot-menu-wait", DEFAULT_BOOTMENU_WAIT);
-    int scan_code = get_keystroke(menu_time);
-    if (scan_code != setup_menu_key && scan_code != boot_menu_key)
+    if (!has_ps2_keyboard && !usb_kbd_active()) {
+        // Nobody can press a key - only wait if asked to (serial console).
+        menu_time = romfile_loadint("etc/boot-menu-wait-nokbd", 0);
+        dprintf(1, "No keyboard found - boot menu wait %d ms\n", menu_time);
+    }
+    if (BootProbesAbandoned)
+        // Early boot - don't wait for a key that wasn't pressed in time.
+        menu_time = 0;
+    int scan_code = BootEarlyKey;
+    if (scan_code < 0 && anykey && post_key >= 0)
+        scan_code = post_key;
+    if (scan_code < 0)
+        scan_code = get_keystroke(menu_time);
+    if (scan_code != SETUP_MENU_KEY && scan_code != BOOT_MENU_KEY)
         return;
 
     while (get_keystroke(0) >= 0);
 
-    if (scan_code == setup_menu_key) {
+    if (scan_code == SETUP_MENU_KEY) {
         bios_setup_main(&s);
         return;
     }
@@ -734,6 +794,8 @@ do_boot(int seq_nr)
     if (! CONFIG_BOOT)
         panic("Boot support not compiled in.\n");
 
+    disk_write_cache_flush();
+
     if (seq_nr >= BEVCount)
         boot_fail();
 
@@ -86,6 +86,21 @@ struct cbmem_console {
 } PACKED;
 static struct cbmem_console *cbcon = NULL;
 
+#define CB_TAG_TIMESTAMPS 0x16
+
+struct cb_timestamp_entry {
+    u32 entry_id;
+    u64 entry_stamp;
+} PACKED;
+
+struct cb_timestamp_table {
+    u64 base_time;
+    u32 max_entries;
+    u32 num_entries;
+    struct cb_timestamp_entry entries[0];
+} PACKED;
+static struct cb_timestamp_table *cbts = NULL;
+
 static u16
 ipchksum(char *buf, int count)
 {
@@ -198,6 +213,13 @@ coreboot_preinit(void)
         dprintf(1, "Found coreboot cbmem console @ %llx\n", cbref->cbmem_addr);
     }
 
+    cbref = find_cb_subtable(cbh, CB_TAG_TIMESTAMPS);
+    if (cbref) {
+        cbts = (void*)(u32)cbref->cbmem_addr;
+        dprintf(1, "Found coreboot timestamps @ %llx\n", cbref->cbmem_addr);
+        coreboot_timestamp(TS_SEABIOS_START);
+    }
+
     struct cb_mainboard *cbmb = find_cb_subtable(cbh, CB_TAG_MAINBOARD);
     if (cbmb) {
         CBvendor = &cbmb->strings[cbmb->vendor_idx];
@@ -225,6 +247,20 @@ void coreboot_debug_putc(char c)
         cbcon->buffer_body[cursor] = c;
 }
 
+// Append a boot phase timestamp to coreboot's table (see "cbmem -t").
+void
+coreboot_timestamp(u32 id)
+{
+    if (!CONFIG_COREBOOT || !cbts)
+        return;
+    u32 n = cbts->num_entries;
+    if (n >= cbts->max_entries)
+        return;
+    cbts->entries[n].entry_id = id;
+    cbts->entries[n].entry_stamp = rdtscll() - cbts->base_time;
+    cbts->num_entries = n + 1;
+}
+
 /****************************************************************
  * BIOS table copying
  ****************************************************************/
@@ -269,6 +305,10 @@ coreboot_platform_setup(void)
  * ulzma
  ****************************************************************/
 
+// Decompress at most this much between yields so that other threads
+// (eg, usb and ata detection) can make progress.
+#define ULZMA_CHUNK (64*1024)
+
 // Uncompress data in flash to an area of memory.
 static int
 ulzma(u8 *dst, u32 maxlen, const u8 *src, u32 srclen)
@@ -280,24 +320,35 @@ ulzma(u8 *dst, u32 maxlen, const u8 *src, u32 srclen)
         dprintf(1, "LzmaDecodeProperties error - %d\n", ret);
         return -1;
     }
-    u8 scratch[15980];
-    int need = (LzmaGetNumProbs(&state.Properties) * sizeof(CProb));
-    if (need > sizeof(scratch)) {
-        dprintf(1, "LzmaDecode need %d have %d\n", need, (unsigned int)sizeof(scratch));
-        return -1;
-    }
-    state.Probs = (CProb *)scratch;
-
     u32 dstlen = *(u32*)(src + LZMA_PROPERTIES_SIZE);
     if (dstlen > maxlen) {
         dprintf(1, "LzmaDecode too large (max %d need %d)\n", maxlen, dstlen);
         return -1;
     }
-    u32 inProcessed, outProcessed;
-    ret = LzmaDecode(&state, src + LZMA_PROPERTIES_SIZE + 8, srclen
-                     , &inProcessed, dst, dstlen, &outProcessed);
-    if (ret) {
-        dprintf(1, "LzmaDecode returned %d\n", ret);
+    // The probability table is too large for a thread stack.
+    int need = (LzmaGetNumProbs(&state.Properties) * sizeof(CProb));
+    state.Probs = malloc_tmp(need);
+    if (!state.Probs) {
+        warn_noalloc();
+        return -1;
+    }
+
+    u32 inProcessed, outProcessed = 0;
+    LzmaDecoderInit(&state);
+    while (outProcessed < dstlen) {
+        u32 end = outProcessed + ULZMA_CHUNK;
+        if (end > dstlen)
+            end = dstlen;
+        ret = LzmaDecode(&state, src + LZMA_PROPERTIES_SIZE + 8, srclen
+                         , &inProcessed, dst, end, &outProcessed);
+        if (ret || outProcessed != end)
+            break;
+        yield();
+    }
+    free(state.Probs);
+    if (ret || outProcessed != dstlen) {
+        dprintf(1, "LzmaDecode returned %d (%d of %d)\n"
+                , ret, outProcessed, dstlen);
         return -1;
     }
     return dstlen;
@@ -374,6 +425,20 @@ cbfs_copyfile(struct romfile_s *file, void *dst, u32 maxlen)
     return size;
 }
 
+// Return a pointer to the raw (possibly still compressed) contents
+// of a CBFS file.  For lzma files the data starts with the lzma header.
+void *
+cbfs_romfile_data(struct romfile_s *file, u32 *rawsize, int *islzma)
+{
+    if (!CONFIG_COREBOOT_FLASH || file->copy != cbfs_copyfile)
+        return NULL;
+    struct cbfs_romfile_s *cfile;
+    cfile = container_of(file, struct cbfs_romfile_s, file);
+    *rawsize = cfile->rawsize;
+    *islzma = cfile->flags;
+    return cfile->data;
+}
+
 // Process CBFS links file.  The links file is a newline separated
 // file where each line has a "link name" and a "destination name"
 // separated by a space character.
@@ -430,12 +495,24 @@ coreboot_cbfs_init(void)
 
     u32 romsize = be32_to_cpu(hdr->romsize);
     u32 romstart = CONFIG_CBFS_LOCATION - romsize;
+    u32 align = be32_to_cpu(hdr->align);
     struct cbfs_file *fhdr = (void*)romstart + be32_to_cpu(hdr->offset);
+    // Each file header and name is read from flash with a single copy
+    // instead of one uncached access per field.
+    u8 buf[sizeof(struct cbfs_file) + sizeof(((struct romfile_s*)0)->name)];
+    struct cbfs_file *chdr = (void*)buf;
     for (;;) {
-        if ((u32)fhdr - romstart > romsize)
+        u32 pos = (u32)fhdr - romstart;
+        if (pos > romsize)
+            break;
+        u32 copylen = romsize - pos;
+        if (copylen < sizeof(*chdr))
             break;
-        u64 magic = fhdr->magic;
-        if (magic != CBFS_FILE_MAGIC)
+        if (copylen > sizeof(buf))
+            copylen = sizeof(buf);
+        iomemcpy(buf, fhdr, copylen);
+        memset(buf + copylen, 0, sizeof(buf) - copylen);
+        if (chdr->magic != CBFS_FILE_MAGIC)
             break;
         struct cbfs_romfile_s *cfile = malloc_tmp(sizeof(*cfile));
         if (!cfile) {
@@ -443,11 +520,11 @@ coreboot_cbfs_init(void)
             break;
         }
         memset(cfile, 0, sizeof(*cfile));
-        strtcpy(cfile->file.name, fhdr->filename, sizeof(cfile->file.name));
-        cfile->file.size = cfile->rawsize = be32_to_cpu(fhdr->len);
+        strtcpy(cfile->file.name, chdr->filename, sizeof(cfile->file.name));
+        cfile->file.size = cfile->rawsize = be32_to_cpu(chdr->len);
         cfile->fhdr = fhdr;
         cfile->file.copy = cbfs_copyfile;
-        cfile->data = (void*)fhdr + be32_to_cpu(fhdr->offset);
+        cfile->data = (void*)fhdr + be32_to_cpu(chdr->offset);
         int len = strlen(cfile->file.name);
         if (len > 5 && strcmp(&cfile->file.name[len-5], ".lzma") == 0) {
             // Using compression.
@@ -457,8 +534,7 @@ coreboot_cbfs_init(void)
         }
         romfile_add(&cfile->file);
 
-        fhdr = (void*)ALIGN((u32)cfile->data + cfile->rawsize
-                            , be32_to_cpu(hdr->align));
+        fhdr = (void*)ALIGN((u32)cfile->data + cfile->rawsize, align);
     }
 
     process_links_file();
@@ -137,16 +137,16 @@ int LzmaDecode(CLzmaDecoderState *vs,
     unsigned char *outStream, SizeT outSize, SizeT *outSizeProcessed)
 {
   CProb *p = vs->Probs;
-  SizeT nowPos = 0;
-  Byte previousByte = 0;
+  SizeT nowPos;
+  Byte previousByte;
   UInt32 posStateMask = (1 << (vs->Properties.pb)) - 1;
   UInt32 literalPosMask = (1 << (vs->Properties.lp)) - 1;
   int lc = vs->Properties.lc;
 
 
-  int state = 0;
-  UInt32 rep0 = 1, rep1 = 1, rep2 = 1, rep3 = 1;
-  int len = 0;
+  int state;
+  UInt32 rep0, rep1, rep2, rep3;
+  int len;
   const Byte *Buffer;
   const Byte *BufferLim;
   UInt32 Range;
@@ -155,17 +155,47 @@ int LzmaDecode(CLzmaDecoderState *vs,
   *inSizeProcessed = 0;
   *outSizeProcessed = 0;
 
+  if (vs->RemainLen == kLzmaNeedInitId)
   {
-    UInt32 i;
-    UInt32 numProbs = Literal + ((UInt32)LZMA_LIT_SIZE << (lc + vs->Properties.lp));
-    for (i = 0; i < numProbs; i++)
-      p[i] = kBitModelTotal >> 1;
+    {
+      UInt32 i;
+      UInt32 numProbs = Literal + ((UInt32)LZMA_LIT_SIZE << (lc + vs->Properties.lp));
+      for (i = 0; i < numProbs; i++)
+        p[i] = kBitModelTotal >> 1;
+    }
+
+    RC_INIT(inStream, inSize);
+
+    nowPos = 0;
+    state = 0;
+    rep0 = rep1 = rep2 = rep3 = 1;
+    len = 0;
   }
-  
-  RC_INIT(inStream, inSize);
+  else
+  {
+    Buffer = vs->Buffer;
+    BufferLim = vs->BufferLim;
+    Range = vs->Range;
+    Code = vs->Code;
+    nowPos = vs->NowPos;
+    state = vs->State;
+    rep0 = vs->Reps[0];
+    rep1 = vs->Reps[1];
+    rep2 = vs->Reps[2];
+    rep3 = vs->Reps[3];
+    len = vs->RemainLen;
+  }
+  previousByte = nowPos ? outStream[nowPos - 1] : 0;
 
+  /* finish a match interrupted by the previous call */
+  while (len > 0 && nowPos < outSize)
+  {
+    previousByte = outStream[nowPos - rep0];
+    len--;
+    outStream[nowPos++] = previousByte;
+  }
 
-  while(nowPos < outSize)
+  while(len != kLzmaStreamWasFinishedId && nowPos < outSize)
   {
     CProb *prob;
     UInt32 bound;
@@ -391,6 +421,17 @@ int LzmaDecode(CLzmaDecoderState *vs,
   }
   RC_NORMALIZE;
 
+  vs->Buffer = Buffer;
+  vs->BufferLim = BufferLim;
+  vs->Range = Range;
+  vs->Code = Code;
+  vs->NowPos = nowPos;
+  vs->State = state;
+  vs->Reps[0] = rep0;
+  vs->Reps[1] = rep1;
+  vs->Reps[2] = rep2;
+  vs->Reps[3] = rep3;
+  vs->RemainLen = len;
 
   *inSizeProcessed = (SizeT)(Buffer - inStream);
   *outSizeProcessed = nowPos;
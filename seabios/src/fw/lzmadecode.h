@@ -56,9 +56,24 @@ typedef struct _CLzmaDecoderState
   CLzmaProperties Properties;
   CProb *Probs;
 
-
+  /* Decoder state saved between calls so that decoding can be resumed */
+  const unsigned char *Buffer;
+  const unsigned char *BufferLim;
+  UInt32 Range;
+  UInt32 Code;
+  SizeT NowPos;
+  UInt32 Reps[4];
+  int State;
+  int RemainLen;
 } CLzmaDecoderState;
 
+#define LzmaDecoderInit(vs) { (vs)->RemainLen = kLzmaNeedInitId; }
+
+/* LzmaDecode may be called repeatedly with the same inStream, inSize
+   and outStream (which also serves as the dictionary) and a growing
+   outSize to uncompress the stream piecewise.  The processed sizes
+   returned are totals since LzmaDecoderInit. */
+
 
 int LzmaDecode(CLzmaDecoderState *vs,
     const unsigned char *inStream, SizeT inSize, SizeT *inSizeProcessed,
@@ -543,6 +543,11 @@ ahci_port_detect(void *data)
     struct ahci_port_s *port = data;
     int rc;
 
+    if (boot_probe_abandoned()) {
+        ahci_port_release(port);
+        return;
+    }
+
     dprintf(2, "AHCI/%d: probing\n", port->pnr);
     ahci_port_reset(port->ctrl, port->pnr);
     rc = ahci_port_setup(port);
@@ -23,6 +23,7 @@
 #include "x86.h" // inb
 
 #define IDE_TIMEOUT 32000 //32 seconds max for IDE ops
+#define IDE_EMPTY_TIMEOUT 500 // spinup wait for drives absent on last boot
 
 
 /****************************************************************
@@ -188,8 +189,9 @@ send_cmd(struct atadrive_s *adrive_gf, struct ata_pio_command *cmd)
             return status;
     }
 
-    // Check for ATA_CMD_(READ|WRITE)_(SECTORS|DMA)_EXT commands.
-    if ((cmd->command & ~0x11) == ATA_CMD_READ_SECTORS_EXT) {
+    // Check for ATA_CMD_(READ|WRITE)_(SECTORS|DMA|MULTIPLE)_EXT commands.
+    if ((cmd->command & ~0x11) == ATA_CMD_READ_SECTORS_EXT
+        || (cmd->command & ~0x10) == ATA_CMD_READ_MULTIPLE_EXT) {
         outb(cmd->feature2, iobase1 + ATA_CB_FR);
         outb(cmd->sector_count2, iobase1 + ATA_CB_SC);
         outb(cmd->lba_low2, iobase1 + ATA_CB_SN);
@@ -270,12 +272,14 @@ fail:
  ****************************************************************/
 
 // Transfer 'op->count' blocks (of 'blocksize' bytes) to/from drive
-// 'op->drive_gf'.
+// 'op->drive_gf', 'multiple' blocks per data request.
 static int
-ata_pio_transfer(struct disk_op_s *op, int iswrite, int blocksize)
+ata_pio_transfer(struct disk_op_s *op, int iswrite, int blocksize
+                 , int multiple)
 {
-    dprintf(16, "ata_pio_transfer id=%p write=%d count=%d bs=%d buf=%p\n"
-            , op->drive_gf, iswrite, op->count, blocksize, op->buf_fl);
+    dprintf(16, "ata_pio_transfer id=%p write=%d count=%d bs=%d mult=%d buf=%p\n"
+            , op->drive_gf, iswrite, op->count, blocksize, multiple
+            , op->buf_fl);
 
     struct atadrive_s *adrive_gf = container_of(
         op->drive_gf, struct atadrive_s, drive);
@@ -286,22 +290,24 @@ ata_pio_transfer(struct disk_op_s *op, int iswrite, int blocksize)
     void *buf_fl = op->buf_fl;
     int status;
     for (;;) {
+        int blocks = count < multiple ? count : multiple;
+        int bytes = blocks * blocksize;
         if (iswrite) {
             // Write data to controller
             dprintf(16, "Write sector id=%p dest=%p\n", op->drive_gf, buf_fl);
             if (CONFIG_ATA_PIO32)
-                outsl_fl(iobase1, buf_fl, blocksize / 4);
+                outsl_fl(iobase1, buf_fl, bytes / 4);
             else
-                outsw_fl(iobase1, buf_fl, blocksize / 2);
+                outsw_fl(iobase1, buf_fl, bytes / 2);
         } else {
             // Read data from controller
             dprintf(16, "Read sector id=%p dest=%p\n", op->drive_gf, buf_fl);
             if (CONFIG_ATA_PIO32)
-                insl_fl(iobase1, buf_fl, blocksize / 4);
+                insl_fl(iobase1, buf_fl, bytes / 4);
             else
-                insw_fl(iobase1, buf_fl, blocksize / 2);
+                insw_fl(iobase1, buf_fl, bytes / 2);
         }
-        buf_fl += blocksize;
+        buf_fl += bytes;
 
         status = pause_await_not_bsy(iobase1, iobase2);
         if (status < 0) {
@@ -310,7 +316,7 @@ ata_pio_transfer(struct disk_op_s *op, int iswrite, int blocksize)
             return status;
         }
 
-        count--;
+        count -= blocks;
         if (!count)
             break;
         status &= (ATA_CB_STAT_BSY | ATA_CB_STAT_DRQ | ATA_CB_STAT_ERR);
@@ -353,49 +359,99 @@ struct sff_dma_prd {
     u32 count;
 };
 
+// Dedicated PRD table (falls back to 16 entries at the bottom of
+// ExtraStack if it couldn't be allocated).
+#define ATA_PRD_COUNT 64
+struct sff_dma_prd *AtaPrdTable VARFSEG;
+
+// Requests done with DMA, and requests on a DMA capable channel that
+// still had to use PIO.
+struct ata_dma_stats_s {
+    u32 dma;
+    u32 bounced;         // unaligned buffer - DMA via the bounce buffer
+    u32 pio_unaligned;   // unaligned buffer and no bounce buffer
+    u32 pio_prd;         // too many PRD entries needed
+} AtaDmaStats VARLOW;
+
+#define ATA_DMA_STAT_INC(field)                                 \
+    SET_LOW(AtaDmaStats.field, GET_LOW(AtaDmaStats.field) + 1)
+
+static void
+ata_dma_fallback(const char *reason)
+{
+    dprintf(3, "ata: PIO fallback (%s) - %d dma %d bounced"
+            " %d unaligned %d prd\n", reason
+            , GET_LOW(AtaDmaStats.dma), GET_LOW(AtaDmaStats.bounced)
+            , GET_LOW(AtaDmaStats.pio_unaligned)
+            , GET_LOW(AtaDmaStats.pio_prd));
+}
+
+// Return the bus-master base of the drive's channel (0 if none).
+static u16
+ata_iomaster(struct disk_op_s *op)
+{
+    if (! CONFIG_ATA_DMA)
+        return 0;
+    struct atadrive_s *adrive_gf = container_of(
+        op->drive_gf, struct atadrive_s, drive);
+    struct ata_channel_s *chan_gf = GET_GLOBALFLAT(adrive_gf->chan_gf);
+    return GET_GLOBALFLAT(chan_gf->iomaster);
+}
+
 // Check if DMA available and setup transfer if so.
 static int
 ata_try_dma(struct disk_op_s *op, int iswrite, int blocksize)
 {
-    ASSERT16();
     if (! CONFIG_ATA_DMA)
         return -1;
+    u16 iomaster = ata_iomaster(op);
+    if (! iomaster)
+        return -1;
     u32 dest = (u32)op->buf_fl;
-    if (dest & 1)
+    if (dest & 1) {
         // Need minimum alignment of 1.
+        ATA_DMA_STAT_INC(pio_unaligned);
+        ata_dma_fallback("unaligned");
         return -1;
-    struct atadrive_s *adrive_gf = container_of(
-        op->drive_gf, struct atadrive_s, drive);
-    struct ata_channel_s *chan_gf = GET_GLOBALFLAT(adrive_gf->chan_gf);
-    u16 iomaster = GET_GLOBALFLAT(chan_gf->iomaster);
-    if (! iomaster)
-        return -1;
+    }
     u32 bytes = op->count * blocksize;
     if (! bytes)
         return -1;
 
     // Build PRD dma structure.
-    struct sff_dma_prd *dma = MAKE_FLATPTR(SEG_LOW, ExtraStack);
+    struct sff_dma_prd *dma = GET_GLOBAL(AtaPrdTable);
+    int maxprd = ATA_PRD_COUNT;
+    if (!dma) {
+        if (!MODESEGMENT)
+            // ExtraStack may be the stack of the 16bit caller - use pio.
+            return -1;
+        dma = MAKE_FLATPTR(SEG_LOW, ExtraStack);
+        maxprd = 16;
+    }
     struct sff_dma_prd *origdma = dma;
     while (bytes) {
-        if (dma >= &origdma[16])
+        if (dma >= &origdma[maxprd]) {
             // Too many descriptors..
+            ATA_DMA_STAT_INC(pio_prd);
+            ata_dma_fallback("prd");
             return -1;
+        }
         u32 count = bytes;
         u32 max = 0x10000 - (dest & 0xffff);
         if (count > max)
             count = max;
 
-        SET_LOWFLAT(dma->buf_fl, dest);
+        SET_FLATPTR(dma->buf_fl, dest);
         bytes -= count;
         if (!bytes)
             // Last descriptor.
             count |= 1<<31;
         dprintf(16, "dma@%p: %08x %08x\n", dma, dest, count);
         dest += count;
-        SET_LOWFLAT(dma->count, count);
+        SET_FLATPTR(dma->count, count);
         dma++;
     }
+    ATA_DMA_STAT_INC(dma);
 
     // Program bus-master controller.
     outl((u32)origdma, iomaster + BM_TABLE);
@@ -479,7 +535,13 @@ ata_pio_cmd_data(struct disk_op_s *op, int iswrite, struct ata_pio_command *cmd)
     ret = ata_wait_data(iobase1);
     if (ret)
         goto fail;
-    ret = ata_pio_transfer(op, iswrite, DISK_SECTOR_SIZE);
+    int multiple = 1;
+    if (cmd->command == ATA_CMD_READ_MULTIPLE
+        || cmd->command == ATA_CMD_WRITE_MULTIPLE
+        || cmd->command == ATA_CMD_READ_MULTIPLE_EXT
+        || cmd->command == ATA_CMD_WRITE_MULTIPLE_EXT)
+        multiple = GET_GLOBALFLAT(adrive_gf->multiple);
+    ret = ata_pio_transfer(op, iswrite, DISK_SECTOR_SIZE, multiple);
 
 fail:
     // Enable interrupts
@@ -501,13 +563,16 @@ ata_dma_cmd_data(struct disk_op_s *op, struct ata_pio_command *cmd)
     return ata_dma_transfer(op);
 }
 
-// Read/write count blocks from a harddrive.
+// Read/write count blocks from a harddrive to/from op->buf_fl.
 static int
-ata_readwrite(struct disk_op_s *op, int iswrite)
+ata_readwrite_direct(struct disk_op_s *op, int iswrite)
 {
     u64 lba = op->lba;
 
     int usepio = ata_try_dma(op, iswrite, DISK_SECTOR_SIZE);
+    struct atadrive_s *adrive_gf = container_of(
+        op->drive_gf, struct atadrive_s, drive);
+    int multiple = usepio && GET_GLOBALFLAT(adrive_gf->multiple) > 1;
 
     struct ata_pio_command cmd;
     memset(&cmd, 0, sizeof(cmd));
@@ -519,14 +584,20 @@ ata_readwrite(struct disk_op_s *op, int iswrite)
         cmd.lba_high2 = lba >> 40;
         lba &= 0xffffff;
 
-        if (usepio)
+        if (multiple)
+            cmd.command = (iswrite ? ATA_CMD_WRITE_MULTIPLE_EXT
+                           : ATA_CMD_READ_MULTIPLE_EXT);
+        else if (usepio)
             cmd.command = (iswrite ? ATA_CMD_WRITE_SECTORS_EXT
                            : ATA_CMD_READ_SECTORS_EXT);
         else
             cmd.command = (iswrite ? ATA_CMD_WRITE_DMA_EXT
                            : ATA_CMD_READ_DMA_EXT);
     } else {
-        if (usepio)
+        if (multiple)
+            cmd.command = (iswrite ? ATA_CMD_WRITE_MULTIPLE
+                           : ATA_CMD_READ_MULTIPLE);
+        else if (usepio)
             cmd.command = (iswrite ? ATA_CMD_WRITE_SECTORS
                            : ATA_CMD_READ_SECTORS);
         else
@@ -550,6 +621,47 @@ ata_readwrite(struct disk_op_s *op, int iswrite)
     return DISK_RET_SUCCESS;
 }
 
+// Bus-master DMA needs a word aligned buffer - transfer requests to odd
+// addresses through the bounce buffer instead of dropping to PIO.
+static int
+ata_readwrite_bounce(struct disk_op_s *op, int iswrite)
+{
+    u8 *bounce_fl = GET_GLOBAL(bounce_buf_fl);
+    u16 maxcount = CDROM_SECTOR_SIZE / DISK_SECTOR_SIZE;
+    struct disk_op_s localop = *op;
+    localop.buf_fl = bounce_fl;
+    void *pos_fl = op->buf_fl;
+    u16 remaining = op->count;
+    while (remaining) {
+        localop.count = remaining < maxcount ? remaining : maxcount;
+        u32 len = localop.count * DISK_SECTOR_SIZE;
+        if (iswrite)
+            memcpy_fl(bounce_fl, pos_fl, len);
+        int ret = ata_readwrite_direct(&localop, iswrite);
+        if (ret) {
+            op->count -= remaining;
+            return ret;
+        }
+        if (!iswrite)
+            memcpy_fl(pos_fl, bounce_fl, len);
+        pos_fl += len;
+        localop.lba += localop.count;
+        remaining -= localop.count;
+    }
+    ATA_DMA_STAT_INC(bounced);
+    return DISK_RET_SUCCESS;
+}
+
+// Read/write count blocks from a harddrive.
+static int
+ata_readwrite(struct disk_op_s *op, int iswrite)
+{
+    if (CONFIG_ATA_DMA && ((u32)op->buf_fl & 1) && GET_GLOBAL(bounce_buf_fl)
+        && ata_iomaster(op))
+        return ata_readwrite_bounce(op, iswrite);
+    return ata_readwrite_direct(op, iswrite);
+}
+
 // 16bit command demuxer for ATA harddrives.
 int
 process_ata_op(struct disk_op_s *op)
@@ -639,7 +751,7 @@ atapi_cmd_data(struct disk_op_s *op, void *cdbcmd, u16 blocksize)
             goto fail;
         }
 
-        ret = ata_pio_transfer(op, 0, blocksize);
+        ret = ata_pio_transfer(op, 0, blocksize, 1);
     }
 
 fail:
@@ -757,6 +869,35 @@ init_drive_atapi(struct atadrive_s *dummy, u16 *buffer)
     return adrive;
 }
 
+// Enable multiple sector mode with the largest block size the drive
+// supports (IDENTIFY word 47).
+static void
+init_multiple(struct atadrive_s *adrive, u16 *buffer)
+{
+    if (!CONFIG_ATA_MULTIPLE)
+        return;
+    u8 max = buffer[47] & 0xff;
+    if (max <= 1)
+        return;
+    u8 multiple = 1;
+    while (multiple * 2 <= max)
+        multiple *= 2;
+
+    struct ata_pio_command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.command = ATA_CMD_SET_MULTIPLE_MODE;
+    cmd.sector_count = multiple;
+    int ret = ata_cmd_nondata(adrive, &cmd);
+    if (ret) {
+        dprintf(1, "ata%d-%d: set multiple mode %d failed (%d)\n"
+                , adrive->chan_gf->chanid, adrive->slave, multiple, ret);
+        return;
+    }
+    adrive->multiple = multiple;
+    dprintf(3, "ata%d-%d: %d sectors per data request\n"
+            , adrive->chan_gf->chanid, adrive->slave, multiple);
+}
+
 // Detect if the given drive is a regular ata drive - initialize it if so.
 static struct atadrive_s *
 init_drive_ata(struct atadrive_s *dummy, u16 *buffer)
@@ -783,6 +924,7 @@ init_drive_ata(struct atadrive_s *dummy, u16 *buffer)
     else
         sectors = *(u32*)&buffer[60]; // word 60 and word 61
     adrive->drive.sectors = sectors;
+    init_multiple(adrive, buffer);
     u64 adjsize = sectors >> 11;
     char adjprefix = 'M';
     if (adjsize >= (1 << 16)) {
@@ -811,7 +953,7 @@ static u32 SpinupEnd;
 
 // Wait for non-busy status and check for "floating bus" condition.
 static int
-powerup_await_non_bsy(u16 base)
+powerup_await_non_bsy(u16 base, u32 end)
 {
     u8 orstatus = 0;
     u8 status;
@@ -824,7 +966,7 @@ powerup_await_non_bsy(u16 base)
             dprintf(4, "powerup IDE floating\n");
             return orstatus;
         }
-        if (timer_check(SpinupEnd)) {
+        if (timer_check(end)) {
             warn_timeout();
             return -1;
         }
@@ -846,17 +988,33 @@ ata_detect(void *data)
     int didreset = 0;
     u8 slave;
     for (slave=0; slave<=1; slave++) {
-        // Wait for not-bsy.
+        if (boot_probe_abandoned())
+            break;
+
+        // Wait for not-bsy - briefly if the drive was absent last boot.
+        u32 end = SpinupEnd;
+        int shortprobe = 0;
+        if (presence_ata(chan_gf->chanid, slave) == 0) {
+            u32 shortend = timer_calc(IDE_EMPTY_TIMEOUT);
+            if ((s32)(shortend - end) < 0) {
+                end = shortend;
+                shortprobe = 1;
+            }
+        }
         u16 iobase1 = chan_gf->iobase1;
-        int status = powerup_await_non_bsy(iobase1);
-        if (status < 0)
-            continue;
         u8 newdh = slave ? ATA_CB_DH_DEV1 : ATA_CB_DH_DEV0;
-        outb(newdh, iobase1+ATA_CB_DH);
-        ndelay(400);
-        status = powerup_await_non_bsy(iobase1);
-        if (status < 0)
+        int status = powerup_await_non_bsy(iobase1, end);
+        if (status >= 0) {
+            outb(newdh, iobase1+ATA_CB_DH);
+            ndelay(400);
+            status = powerup_await_non_bsy(iobase1, end);
+        }
+        if (status < 0) {
+            if (shortprobe)
+                // Still busy - maybe a drive that needs longer to spin up.
+                presence_rescan();
             continue;
+        }
 
         // Check if ioport registers look valid.
         outb(newdh, iobase1+ATA_CB_DH);
@@ -900,6 +1058,7 @@ ata_detect(void *data)
                 // No ATA drive found
                 continue;
         }
+        presence_ata_found(chan_gf->chanid, slave);
 
         u16 resetresult = buffer[93];
         dprintf(6, "ata_detect resetresult=%04x\n", resetresult);
@@ -1034,6 +1193,15 @@ ata_setup(void)
 
     dprintf(3, "init hard drives\n");
 
+    if (CONFIG_ATA_DMA) {
+        // The PRD table must not cross a 64K boundary.
+        u32 size = ATA_PRD_COUNT * sizeof(struct sff_dma_prd);
+        AtaPrdTable = memalign_low(size, size);
+        if (!AtaPrdTable)
+            warn_noalloc();
+        create_bounce_buf();
+    }
+
     SpinupEnd = timer_calc(IDE_TIMEOUT);
     ata_scan();
 
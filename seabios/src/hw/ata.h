@@ -19,6 +19,7 @@ struct atadrive_s {
     struct drive_s drive;
     struct ata_channel_s *chan_gf;
     u8 slave;
+    u8 multiple; // sectors per PIO data request (0 if not enabled)
 };
 
 // ata.c
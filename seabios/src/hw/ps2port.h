@@ -70,6 +70,7 @@ void i8042_reboot(void);
 int ps2_kbd_command(int command, u8 *param);
 int ps2_mouse_command(int command, u8 *param);
 void ps2port_setup(void);
+extern int has_ps2_keyboard;
 
 #endif // !__ASSEMBLY__
 
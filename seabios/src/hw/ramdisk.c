@@ -7,6 +7,8 @@
 #include "biosvar.h" // GET_GLOBALFLAT
 #include "block.h" // struct drive_s
 #include "bregs.h" // struct bregs
+#include "byteorder.h" // be32_to_cpu
+#include "fw/lzmadecode.h" // LzmaDecode
 #include "malloc.h" // malloc_fseg
 #include "memmap.h" // add_e820
 #include "output.h" // dprintf
@@ -16,6 +18,398 @@
 #include "string.h" // memset
 #include "util.h" // process_ramdisk_op
 
+
+/****************************************************************
+ * Image unpacking
+ ****************************************************************/
+
+// Decompress at least this much more of an lzma stream on each fill.
+#define RAMDISK_LZMA_CHUNK (32*1024)
+// Largest lzma probability table supported for block images (lc+lp <= 3).
+#define RAMDISK_LZMA_MAXPROBS ((LZMA_BASE_SIZE + (LZMA_LIT_SIZE << 3)) \
+                               * sizeof(CProb))
+
+// Block compressed image as created by "cbfstool add-blockimage".  The
+// image is split into fixed size blocks that are compressed separately
+// and located via the offsets[] index (block_count+1 entries, relative
+// to the start of the header).  An empty block is all zeros; a block
+// whose stored length equals its size is not compressed.
+struct cbfs_blockimage_s {
+    u32 magic;
+    u32 compression;
+    u32 size;
+    u32 block_size;
+    u32 block_count;
+    u32 offsets[0];
+} PACKED;
+
+#define BLOCKIMAGE_MAGIC 0x42494d47 // "BIMG"
+#define BLOCKIMAGE_COMPRESS_LZMA 1
+
+struct ramdisk_unpack_s {
+    u8 *dst;
+    u32 size;
+    CLzmaDecoderState state;
+    // Single lzma stream
+    u8 *src;
+    u32 srclen;
+    // Block image
+    u8 *data;
+    u32 *offsets;
+    u32 block_size, block_count, compression;
+    u8 *ready, *temp;
+};
+
+// Image still being unpacked (if any) and how much of it is ready.
+struct ramdisk_unpack_s *RamdiskUnpack VARFSEG;
+u32 RamdiskUnpacked VARLOW;
+
+// Stage a compressed floppy image in ram so that it can be
+// decompressed on the first disk access instead of during POST.
+static struct ramdisk_unpack_s *
+ramdisk_lzma_setup(struct romfile_s *file, void *dst, u32 size)
+{
+    u32 rawsize;
+    int islzma;
+    u8 *data = cbfs_romfile_data(file, &rawsize, &islzma);
+    if (!data || !islzma || rawsize < LZMA_PROPERTIES_SIZE + 8)
+        return NULL;
+
+    struct ramdisk_unpack_s *ru = malloc_high(sizeof(*ru));
+    u8 *src = memalign_tmphigh(PAGE_SIZE, rawsize);
+    if (!ru || !src) {
+        warn_noalloc();
+        goto fail;
+    }
+    iomemcpy(src, data, rawsize);
+    memset(ru, 0, sizeof(*ru));
+    int ret = LzmaDecodeProperties(&ru->state.Properties, src
+                                   , LZMA_PROPERTIES_SIZE);
+    u32 dstlen = *(u32*)(src + LZMA_PROPERTIES_SIZE);
+    if (ret != LZMA_RESULT_OK || dstlen != size) {
+        dprintf(1, "Unable to decompress floppy image on demand\n");
+        goto fail;
+    }
+    u32 need = LzmaGetNumProbs(&ru->state.Properties) * sizeof(CProb);
+    ru->state.Probs = malloc_high(need);
+    if (!ru->state.Probs) {
+        warn_noalloc();
+        goto fail;
+    }
+    add_e820((u32)src, rawsize, E820_RESERVED);
+    LzmaDecoderInit(&ru->state);
+    ru->src = src;
+    ru->srclen = rawsize;
+    ru->dst = dst;
+    ru->size = size;
+    dprintf(3, "Floppy image (%d bytes compressed) will be decompressed"
+            " on demand\n", rawsize);
+    return ru;
+
+fail:
+    free(ru);
+    free(src);
+    return NULL;
+}
+
+// Decompress the lzma stream so that at least 'end' bytes are valid.
+static int
+ramdisk_lzma_unpack(struct ramdisk_unpack_s *ru, u32 end)
+{
+    end = ALIGN(end, RAMDISK_LZMA_CHUNK);
+    if (end > ru->size)
+        end = ru->size;
+    if (end <= ru->state.NowPos)
+        return 0;
+
+    dprintf(3, "Decompressing floppy image %d-%d\n", ru->state.NowPos, end);
+    u32 inProcessed, outProcessed;
+    int ret = LzmaDecode(&ru->state, ru->src + LZMA_PROPERTIES_SIZE + 8
+                         , ru->srclen - LZMA_PROPERTIES_SIZE - 8
+                         , &inProcessed, ru->dst, end, &outProcessed);
+    if (ret || outProcessed != end) {
+        dprintf(1, "LzmaDecode returned %d (%d of %d)\n"
+                , ret, outProcessed, end);
+        return -1;
+    }
+    RamdiskUnpacked = end;
+    return 0;
+}
+
+// Return the block image header if 'file' holds a block compressed image.
+static struct cbfs_blockimage_s *
+ramdisk_find_blockimage(struct romfile_s *file)
+{
+    u32 rawsize;
+    int islzma;
+    struct cbfs_blockimage_s *bimg = cbfs_romfile_data(file, &rawsize
+                                                       , &islzma);
+    if (!bimg || islzma || rawsize < sizeof(*bimg)
+        || be32_to_cpu(bimg->magic) != BLOCKIMAGE_MAGIC)
+        return NULL;
+    u32 size = be32_to_cpu(bimg->size);
+    u32 block_size = be32_to_cpu(bimg->block_size);
+    u32 block_count = be32_to_cpu(bimg->block_count);
+    if (!block_size || block_count != DIV_ROUND_UP(size, block_size)
+        || rawsize < sizeof(*bimg) + (block_count + 1) * sizeof(u32)) {
+        dprintf(1, "Invalid block image header\n");
+        return NULL;
+    }
+    return bimg;
+}
+
+// Prepare to unpack the blocks of a block compressed image as needed.
+static struct ramdisk_unpack_s *
+ramdisk_blockimage_setup(struct cbfs_blockimage_s *bimg, void *dst, u32 size)
+{
+    u32 block_size = be32_to_cpu(bimg->block_size);
+    u32 block_count = be32_to_cpu(bimg->block_count);
+    u32 compression = be32_to_cpu(bimg->compression);
+    struct ramdisk_unpack_s *ru = malloc_high(sizeof(*ru));
+    u32 *offsets = malloc_high((block_count + 1) * sizeof(u32));
+    u8 *ready = malloc_high(DIV_ROUND_UP(block_count, 8));
+    u8 *temp = memalign_tmphigh(PAGE_SIZE, block_size);
+    CProb *probs = NULL;
+    if (compression == BLOCKIMAGE_COMPRESS_LZMA)
+        probs = malloc_high(RAMDISK_LZMA_MAXPROBS);
+    if (!ru || !offsets || !ready || !temp
+        || (compression == BLOCKIMAGE_COMPRESS_LZMA && !probs)) {
+        warn_noalloc();
+        free(ru);
+        free(offsets);
+        free(ready);
+        free(temp);
+        free(probs);
+        return NULL;
+    }
+    add_e820((u32)temp, block_size, E820_RESERVED);
+    memset(ru, 0, sizeof(*ru));
+    memset(ready, 0, DIV_ROUND_UP(block_count, 8));
+    iomemcpy(offsets, bimg->offsets, (block_count + 1) * sizeof(u32));
+    int i;
+    for (i=0; i<=block_count; i++)
+        offsets[i] = be32_to_cpu(offsets[i]);
+    ru->dst = dst;
+    ru->size = size;
+    ru->state.Probs = probs;
+    ru->data = (void*)bimg;
+    ru->offsets = offsets;
+    ru->block_size = block_size;
+    ru->block_count = block_count;
+    ru->compression = compression;
+    ru->ready = ready;
+    ru->temp = temp;
+    dprintf(3, "Floppy block image with %d blocks of %d bytes\n"
+            , block_count, block_size);
+    return ru;
+}
+
+// Unpack a single block of a block compressed image into ram.
+static int
+ramdisk_block_unpack(struct ramdisk_unpack_s *ru, u32 block)
+{
+    u32 pos = block * ru->block_size;
+    u32 size = ru->size - pos;
+    if (size > ru->block_size)
+        size = ru->block_size;
+    u8 *dst = ru->dst + pos;
+    u32 start = ru->offsets[block], len = ru->offsets[block+1] - start;
+    if (!len) {
+        // Hole - block is all zeros.
+        memset(dst, 0, size);
+    } else if (len == size) {
+        iomemcpy(dst, ru->data + start, len);
+    } else {
+        if (ru->compression != BLOCKIMAGE_COMPRESS_LZMA || len > size
+            || len < LZMA_PROPERTIES_SIZE + 8)
+            goto fail;
+        iomemcpy(ru->temp, ru->data + start, len);
+        int ret = LzmaDecodeProperties(&ru->state.Properties, ru->temp
+                                       , LZMA_PROPERTIES_SIZE);
+        u32 need = LzmaGetNumProbs(&ru->state.Properties) * sizeof(CProb);
+        if (ret != LZMA_RESULT_OK || need > RAMDISK_LZMA_MAXPROBS)
+            goto fail;
+        u32 inProcessed, outProcessed;
+        LzmaDecoderInit(&ru->state);
+        ret = LzmaDecode(&ru->state, ru->temp + LZMA_PROPERTIES_SIZE + 8
+                         , len - LZMA_PROPERTIES_SIZE - 8
+                         , &inProcessed, dst, size, &outProcessed);
+        if (ret || outProcessed != size)
+            goto fail;
+    }
+    ru->ready[block / 8] |= 1 << (block % 8);
+    return 0;
+
+fail:
+    dprintf(1, "Unable to unpack floppy image block %d\n", block);
+    return -1;
+}
+
+static int
+ramdisk_block_ready(struct ramdisk_unpack_s *ru, u32 block)
+{
+    return ru->ready[block / 8] & (1 << (block % 8));
+}
+
+// Make sure bytes 'start' to 'end' of the image are present in ram.
+static int
+ramdisk_unpack(struct ramdisk_unpack_s *ru, u32 start, u32 end)
+{
+    if (end > ru->size)
+        end = ru->size;
+    if (!ru->block_count)
+        return ramdisk_lzma_unpack(ru, end);
+
+    u32 block;
+    for (block = start / ru->block_size; block * ru->block_size < end
+             ; block++) {
+        if (ramdisk_block_ready(ru, block))
+            continue;
+        int ret = ramdisk_block_unpack(ru, block);
+        if (ret)
+            return ret;
+    }
+
+    // Advance the size of the fully unpacked part at the start.
+    u32 unpacked = RamdiskUnpacked;
+    while (unpacked < ru->size
+           && ramdisk_block_ready(ru, unpacked / ru->block_size))
+        unpacked += ru->block_size;
+    RamdiskUnpacked = unpacked < ru->size ? unpacked : ru->size;
+    return 0;
+}
+
+// Copy the sectors of a disk request between the image and the
+// caller's buffer with a flat memcpy, unpacking them first if needed.
+int VISIBLE32FLAT
+ramdisk_copy_op(struct disk_op_s *op)
+{
+    u32 start = (u32)op->lba * DISK_SECTOR_SIZE;
+    u32 len = op->count * DISK_SECTOR_SIZE;
+    if (CONFIG_FLASH_FLOPPY_LAZY && RamdiskUnpack
+        && start + len > RamdiskUnpacked
+        && ramdisk_unpack(RamdiskUnpack, start, start + len))
+        return DISK_RET_EBADTRACK;
+
+    void *pos = (void*)op->drive_gf->cntl_id + start;
+    if (op->command == CMD_WRITE)
+        memcpy(pos, op->buf_fl, len);
+    else
+        memcpy(op->buf_fl, pos, len);
+    return DISK_RET_SUCCESS;
+}
+
+
+/****************************************************************
+ * Setup and access
+ ****************************************************************/
+
+// Compare the throughput of the int 1587 copy with the flat memcpy
+// used by ramdisk_copy_op().
+static void
+ramdisk_benchmark(void *pos)
+{
+    if (!CONFIG_FLASH_FLOPPY_BENCHMARK)
+        return;
+    u32 len = 18 * DISK_SECTOR_SIZE, loops = 128, i; // one 1.44MB track
+    void *buf = malloc_tmphigh(len);
+    u64 *gdt = malloc_tmplow(6 * sizeof(*gdt));
+    if (!buf || !gdt) {
+        warn_noalloc();
+        goto done;
+    }
+    memset(gdt, 0, 6 * sizeof(*gdt));
+    gdt[2] = GDT_DATA | GDT_LIMIT(0xfffff) | GDT_BASE((u32)pos);
+    gdt[3] = GDT_DATA | GDT_LIMIT(0xfffff) | GDT_BASE((u32)buf);
+
+    u32 start = timer_calc(0);
+    for (i = 0; i < loops; i++) {
+        struct bregs br;
+        memset(&br, 0, sizeof(br));
+        br.flags = F_CF|F_IF;
+        br.ah = 0x87;
+        br.es = FLATPTR_TO_SEG(gdt);
+        br.si = FLATPTR_TO_OFFSET(gdt);
+        br.cx = len / 2;
+        call16_int(0x15, &br);
+        if (br.flags & F_CF)
+            goto done;
+    }
+    u32 int15_ms = ticks_to_ms(timer_calc(0) - start);
+
+    start = timer_calc(0);
+    for (i = 0; i < loops; i++)
+        memcpy(buf, pos, len);
+    u32 flat_ms = ticks_to_ms(timer_calc(0) - start);
+
+    printf("Ramdisk copy of %d KiB: int 1587 %d ms, flat memcpy %d ms\n"
+           , len * loops / 1024, int15_ms, flat_ms);
+done:
+    free(buf);
+    free(gdt);
+}
+
+// Register the drive for a floppy image that is present at 'pos'.
+static void
+ramdisk_add_drive(const char *filename, void *pos, int ftype)
+{
+    struct drive_s *drive = init_floppy((u32)pos, ftype);
+    if (!drive)
+        return;
+    drive->type = DTYPE_RAMDISK;
+    dprintf(1, "Mapping CBFS floppy %s to addr %p\n", filename, pos);
+    // char *desc = znprintf(MAXDESCSIZE, "Ramdisk [%s]", &filename[10]);
+    char *desc = znprintf(MAXDESCSIZE, "Virtual floppy (MS-DOS 6.22)");
+    boot_add_floppy(drive, desc, bootprio_find_named_rom(filename, 0));
+    ramdisk_benchmark(pos);
+}
+
+struct ramdisk_load_s {
+    struct romfile_s *file;
+    struct ramdisk_unpack_s *ru;
+    void *pos;
+    int ftype;
+};
+
+// Unpack the floppy image while other threads wait on hardware.
+static void
+ramdisk_load_thread(void *data)
+{
+    struct ramdisk_load_s *rl = data;
+    struct ramdisk_unpack_s *ru = rl->ru;
+    if (CONFIG_FLASH_FLOPPY_LAZY && ru && RamdiskUnpack == ru) {
+        // The drive is already registered - only unpack ahead of the
+        // first access while the cpu would otherwise be idle.  Whatever
+        // remains is unpacked on demand.
+        while (RamdiskUnpacked < ru->size && have_other_threads()) {
+            if (ramdisk_unpack(ru, RamdiskUnpacked, RamdiskUnpacked + 1))
+                break;
+            yield();
+        }
+        dprintf(3, "Unpacked %d of %d bytes of floppy image during POST\n"
+                , RamdiskUnpacked, ru->size);
+        goto done;
+    }
+
+    if (ru) {
+        u32 block;
+        for (block = 0; block < ru->block_count; block++) {
+            if (ramdisk_block_unpack(ru, block))
+                goto done;
+            yield();
+        }
+    } else {
+        // Copy image into ram.
+        int ret = rl->file->copy(rl->file, rl->pos, rl->file->size);
+        if (ret < 0)
+            goto done;
+    }
+    ramdisk_add_drive(rl->file->name, rl->pos, rl->ftype);
+done:
+    coreboot_timestamp(TS_SEABIOS_END_RAMDISK);
+    free(rl);
+}
+
 void
 ramdisk_setup(void)
 {
@@ -28,7 +422,11 @@ ramdisk_setup(void)
         return;
     const char *filename = file->name;
     u32 size = file->size;
+    struct cbfs_blockimage_s *bimg = ramdisk_find_blockimage(file);
+    if (bimg)
+        size = be32_to_cpu(bimg->size);
     dprintf(3, "Found floppy file %s of size %d\n", filename, size);
+    coreboot_timestamp(TS_SEABIOS_START_RAMDISK);
     int ftype = find_floppy_type(size);
     if (ftype < 0) {
         dprintf(3, "No floppy type found for ramdisk size\n");
@@ -37,26 +435,44 @@ ramdisk_setup(void)
 
     // Allocate ram for image.
     void *pos = memalign_tmphigh(PAGE_SIZE, size);
-    if (!pos) {
+    struct ramdisk_load_s *rl = malloc_tmp(sizeof(*rl));
+    if (!pos || !rl) {
         warn_noalloc();
+        free(pos);
+        free(rl);
         return;
     }
     add_e820((u32)pos, size, E820_RESERVED);
+    memset(rl, 0, sizeof(*rl));
+    rl->file = file;
+    rl->pos = pos;
+    rl->ftype = ftype;
 
-    // Copy image into ram.
-    int ret = file->copy(file, pos, size);
-    if (ret < 0)
-        return;
+    if (bimg) {
+        rl->ru = ramdisk_blockimage_setup(bimg, pos, size);
+        if (!rl->ru) {
+            free(rl);
+            return;
+        }
+        RamdiskUnpacked = 0;
+        if (CONFIG_FLASH_FLOPPY_LAZY)
+            RamdiskUnpack = rl->ru;
+    } else if (CONFIG_FLASH_FLOPPY_LAZY
+               && (RamdiskUnpack = ramdisk_lzma_setup(file, pos, size))) {
+        rl->ru = RamdiskUnpack;
+        RamdiskUnpacked = 0;
+    }
 
-    // Setup driver.
-    struct drive_s *drive = init_floppy((u32)pos, ftype);
-    if (!drive)
-        return;
-    drive->type = DTYPE_RAMDISK;
-    dprintf(1, "Mapping CBFS floppy %s to addr %p\n", filename, pos);
-    // char *desc = znprintf(MAXDESCSIZE, "Ramdisk [%s]", &filename[10]);
-    char *desc = znprintf(MAXDESCSIZE, "Virtual floppy (MS-DOS 6.22)");
-    boot_add_floppy(drive, desc, bootprio_find_named_rom(filename, 0));
+    if (CONFIG_FLASH_FLOPPY_LAZY && RamdiskUnpack) {
+        // Sectors are unpacked on first access, so the drive can be
+        // registered right away.
+        ramdisk_add_drive(filename, pos, ftype);
+        if (!CONFIG_THREADS) {
+            free(rl);
+            return;
+        }
+    }
+    run_thread(ramdisk_load_thread, rl);
 }
 
 static int
@@ -99,9 +515,19 @@ process_ramdisk_op(struct disk_op_s *op)
 
     switch (op->command) {
     case CMD_READ:
-        return ramdisk_copy(op, 0);
-    case CMD_WRITE:
-        return ramdisk_copy(op, 1);
+    case CMD_WRITE: ;
+        extern void _cfunc32flat_ramdisk_copy_op(void);
+        int ret = call32(_cfunc32flat_ramdisk_copy_op
+                         , (u32)MAKE_FLATPTR(GET_SEG(SS), op), -1);
+        if (ret != -1)
+            return ret;
+        // Can't enter 32bit mode (caller in vm86 mode) - use int 1587.
+        if (CONFIG_FLASH_FLOPPY_LAZY && GET_GLOBAL(RamdiskUnpack)) {
+            u32 end = ((u32)op->lba + op->count) * DISK_SECTOR_SIZE;
+            if (end > GET_LOW(RamdiskUnpacked))
+                return DISK_RET_EBADTRACK;
+        }
+        return ramdisk_copy(op, op->command == CMD_WRITE);
     case CMD_VERIFY:
     case CMD_FORMAT:
     case CMD_RESET:
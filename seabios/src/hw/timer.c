@@ -150,7 +150,7 @@ timer_adjust_bits(u32 value, u32 validbits)
 }
 
 // Sample the current timer value.
-static u32
+u32
 timer_read(void)
 {
     u16 port = GET_GLOBAL(TimerPort);
@@ -188,7 +188,7 @@ timer_sleep(u32 diff)
     u32 start = timer_read();
     u32 end = start + diff;
     while (!timer_check(end))
-        yield();
+        yield_until(end);
 }
 
 void ndelay(u32 count) {
@@ -11,6 +11,7 @@
 #include "pci.h" // pci_bdf_to_bus
 #include "pci_ids.h" // PCI_CLASS_SERIAL_USB_UHCI
 #include "pci_regs.h" // PCI_BASE_ADDRESS_0
+#include "romfile.h" // romfile_loadint
 #include "string.h" // memset
 #include "usb.h" // struct usb_s
 #include "usb-ehci.h" // struct ehci_qh
@@ -34,6 +35,10 @@ struct ehci_pipe {
 
 static int PendingEHCIPorts;
 
+// Board quirk - only hand one qtd at a time to the controller on bulk
+// pipes instead of keeping a chain of them in flight.
+int EhciSingleQtd VARFSEG;
+
 
 /****************************************************************
  * Root hub
@@ -69,8 +74,10 @@ ehci_hub_detect(struct usbhub_s *hub, u32 port)
 
     u32 end = timer_calc(EHCI_TIME_POSTPOWER);
 
+    // Ports that were empty on the last boot don't wait for slow devices.
     u32 timer_from_cpu_power_on = timer_calc_from_cpu_power_on(EHCI_TIME_POSTCPUPOWER);
-    if (end < timer_from_cpu_power_on)
+    if (end < timer_from_cpu_power_on
+        && presence_usb(cntl->usb.pci->bdf, port) != 0)
         end = timer_from_cpu_power_on;
 
     for (;;) {
@@ -354,6 +361,7 @@ ehci_setup(void)
 {
     if (! CONFIG_USB_EHCI)
         return;
+    EhciSingleQtd = romfile_loadint("etc/usb-ehci-single-qtd", 0);
     struct pci_device *pci;
     foreachpci(pci) {
         if (pci_classprog(pci) == PCI_CLASS_SERIAL_USB_EHCI)
@@ -488,10 +496,11 @@ ehci_alloc_pipe(struct usbdevice_s *usbdev
         return usbpipe;
     }
 
-    // Allocate a new queue head.
+    // Allocate a new queue head.  Control pipes may be kept for use
+    // after POST (usb-msc reset recovery), so they can't be temporary.
     struct ehci_pipe *pipe;
     if (eptype == USB_ENDPOINT_XFER_CONTROL)
-        pipe = memalign_tmphigh(EHCI_QH_ALIGN, sizeof(*pipe));
+        pipe = memalign_high(EHCI_QH_ALIGN, sizeof(*pipe));
     else
         pipe = memalign_low(EHCI_QH_ALIGN, sizeof(*pipe));
     if (!pipe) {
@@ -589,12 +598,9 @@ ehci_control(struct usb_pipe *p, int dir, const void *cmd, int cmdsize
     }
     struct ehci_pipe *pipe = container_of(p, struct ehci_pipe, pipe);
 
-    // Setup transfer descriptors
-    struct ehci_qtd *tds = memalign_tmphigh(EHCI_QTD_ALIGN, sizeof(*tds) * 3);
-    if (!tds) {
-        warn_noalloc();
-        return -1;
-    }
+    // Setup transfer descriptors (on stack, with required alignment)
+    u8 tdsbuf[sizeof(struct ehci_qtd) * 3 + EHCI_QTD_ALIGN - 1];
+    struct ehci_qtd *tds = (void*)ALIGN((u32)tdsbuf, EHCI_QTD_ALIGN);
     memset(tds, 0, sizeof(*tds) * 3);
     struct ehci_qtd *td = tds;
 
@@ -630,7 +636,6 @@ ehci_control(struct usb_pipe *p, int dir, const void *cmd, int cmdsize
         if (ret)
             break;
     }
-    free(tds);
     return ret;
 }
 
@@ -650,27 +655,41 @@ ehci_send_bulk(struct usb_pipe *p, int dir, void *data, int datasize)
     struct ehci_qtd *tds = (void*)ALIGN((u32)tdsbuf, EHCI_QTD_ALIGN);
     memset(tds, 0, sizeof(*tds) * STACKQTDS);
     barrier();
-    //SET_LOWFLAT(pipe->qh.qtd_next, (u32)MAKE_FLATPTR(GET_SEG(SS), tds));
+
+    // The tds form a ring that the controller follows while it is
+    // filled - each td is reused once the controller finished it.  An
+    // inactive td stops the controller until it is activated.
+    int chain = !GET_GLOBAL(EhciSingleQtd);
+    if (chain)
+        SET_LOWFLAT(pipe->qh.qtd_next, (u32)MAKE_FLATPTR(GET_SEG(SS), tds));
 
     u16 maxpacket = GET_LOWFLAT(pipe->pipe.maxpacket);
     int tdpos = 0;
     while (datasize) {
+        struct ehci_qtd *td = &tds[tdpos++ % STACKQTDS];
+        int ret = ehci_wait_td(pipe, td, 5000);
+        if (ret)
+            return -1;
 
-        struct ehci_qtd *td = &tds[tdpos % STACKQTDS];
-        //struct ehci_qtd *nexttd_fl = MAKE_FLATPTR(GET_SEG(SS)
-        //                                         , &tds[tdpos % STACKQTDS]);
+        struct ehci_qtd *nexttd_fl = MAKE_FLATPTR(GET_SEG(SS)
+                                                 , &tds[tdpos % STACKQTDS]);
 
         int transfer = fillTDbuffer(td, maxpacket, data, datasize);
-        td->qtd_next = 0x1;//(transfer==datasize ? EHCI_PTR_TERM : (u32)nexttd_fl);
+        td->qtd_next = (transfer==datasize || !chain
+                        ? EHCI_PTR_TERM : (u32)nexttd_fl);
         td->alt_next = EHCI_PTR_TERM;
         barrier();
         td->token = (ehci_explen(transfer) | QTD_STS_ACTIVE
                      | (dir ? QTD_PID_IN : QTD_PID_OUT) | ehci_maxerr(3));
 
-        SET_LOWFLAT(pipe->qh.qtd_next, (u32)MAKE_FLATPTR(GET_SEG(SS), td));
-        int ret = ehci_wait_td(pipe, td, 5000);
-        if (ret)
-            return -1;
+        if (!chain) {
+            // Hand over this td alone and wait for it to finish.
+            SET_LOWFLAT(pipe->qh.qtd_next
+                        , (u32)MAKE_FLATPTR(GET_SEG(SS), td));
+            ret = ehci_wait_td(pipe, td, 5000);
+            if (ret)
+                return -1;
+        }
         data += transfer;
         datasize -= transfer;
     }
@@ -685,6 +704,15 @@ ehci_send_bulk(struct usb_pipe *p, int dir, void *data, int datasize)
     return 0;
 }
 
+void
+ehci_reset_toggle(struct usb_pipe *p)
+{
+    if (! CONFIG_USB_EHCI)
+        return;
+    struct ehci_pipe *pipe = container_of(p, struct ehci_pipe, pipe);
+    pipe->qh.token &= ~QTD_TOGGLE;
+}
+
 int
 ehci_poll_intr(struct usb_pipe *p, void *data)
 {
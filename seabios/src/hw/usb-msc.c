@@ -7,9 +7,12 @@
 #include "biosvar.h" // GET_GLOBALFLAT
 #include "block.h" // DTYPE_USB
 #include "blockcmd.h" // cdb_read
+#include "byteorder.h" // be32_to_cpu
 #include "config.h" // CONFIG_USB_MSC
 #include "malloc.h" // free
 #include "output.h" // dprintf
+#include "romfile.h" // romfile_loadint
+#include "stacks.h" // call32
 #include "std/disk.h" // DISK_RET_SUCCESS
 #include "string.h" // memset
 #include "usb.h" // struct usb_s
@@ -20,6 +23,10 @@ struct usbdrive_s {
     struct drive_s drive;
     struct usb_pipe *bulkin, *bulkout;
     int lun;
+    u16 max_sectors;
+    // Control pipe, used for reset recovery.
+    struct usb_pipe *defpipe;
+    u8 iface;
 };
 
 
@@ -50,6 +57,9 @@ struct csw_s {
     u8 bCSWStatus;
 } PACKED;
 
+// Tag of the last command block wrapper sent.
+u32 UsbMscTag VARLOW;
+
 static int
 usb_msc_send(struct usbdrive_s *udrive_gf, int dir, void *buf, u32 bytes)
 {
@@ -61,29 +71,66 @@ usb_msc_send(struct usbdrive_s *udrive_gf, int dir, void *buf, u32 bytes)
     return usb_send_bulk(pipe, dir, buf, bytes);
 }
 
-// Low-level usb command transmit function.
-int
-usb_cmd_data(struct disk_op_s *op, void *cdbcmd, u16 blocksize)
+// Clear a halted bulk endpoint.
+static void
+usb_msc_clear_halt(struct usbdrive_s *udrive_gf, struct usb_pipe *pipe)
 {
-    if (!CONFIG_USB_MSC)
-        return 0;
+    struct usb_ctrlrequest req;
+    req.bRequestType = USB_DIR_OUT | USB_TYPE_STANDARD | USB_RECIP_ENDPOINT;
+    req.bRequest = USB_REQ_CLEAR_FEATURE;
+    req.wValue = 0; // ENDPOINT_HALT
+    req.wIndex = pipe->ep | (pipe == udrive_gf->bulkin ? USB_DIR_IN : 0);
+    req.wLength = 0;
+    send_default_control(udrive_gf->defpipe, &req, NULL);
+    usb_reset_toggle(pipe);
+}
 
-    dprintf(16, "usb_cmd_data id=%p write=%d count=%d bs=%d buf=%p\n"
-            , op->drive_gf, 0, op->count, blocksize, op->buf_fl);
-    struct usbdrive_s *udrive_gf = container_of(
-        op->drive_gf, struct usbdrive_s, drive);
+// Bulk-Only reset recovery - reset the device and clear the halt of
+// both bulk endpoints.  Control transfers only work in 32bit mode, so
+// 16bit callers go through call32.
+void VISIBLE32FLAT
+usb_msc_reset(struct usbdrive_s *udrive_gf)
+{
+    if (MODESEGMENT) {
+        extern void _cfunc32flat_usb_msc_reset(void);
+        call32(_cfunc32flat_usb_msc_reset, (u32)udrive_gf, 0);
+        return;
+    }
+    if (!udrive_gf->defpipe)
+        return;
+    dprintf(1, "USB MSC reset recovery\n");
+    struct usb_ctrlrequest req;
+    req.bRequestType = USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE;
+    req.bRequest = 0xff; // Bulk-Only Mass Storage Reset
+    req.wValue = 0;
+    req.wIndex = udrive_gf->iface;
+    req.wLength = 0;
+    int ret = send_default_control(udrive_gf->defpipe, &req, NULL);
+    if (ret)
+        return;
+    usb_msc_clear_halt(udrive_gf, udrive_gf->bulkin);
+    usb_msc_clear_halt(udrive_gf, udrive_gf->bulkout);
+}
 
+// Send a single command and transfer its data.  On a failed command
+// the number of bytes not transferred is stored in 'residue'.
+static int
+usb_msc_command(struct usbdrive_s *udrive_gf, void *cdbcmd, int dir
+                , void *buf, u32 bytes, u32 *residue)
+{
     // Setup command block wrapper.
-    u32 bytes = blocksize * op->count;
+    u32 tag = GET_LOW(UsbMscTag) + 1;
+    SET_LOW(UsbMscTag, tag);
     struct cbw_s cbw;
     memset(&cbw, 0, sizeof(cbw));
     memcpy(cbw.CBWCB, cdbcmd, USB_CDB_SIZE);
     cbw.dCBWSignature = CBW_SIGNATURE;
-    cbw.dCBWTag = 999; // XXX
+    cbw.dCBWTag = tag;
     cbw.dCBWDataTransferLength = bytes;
-    cbw.bmCBWFlags = cdb_is_read(cdbcmd, blocksize) ? USB_DIR_IN : USB_DIR_OUT;
+    cbw.bmCBWFlags = dir;
     cbw.bCBWLUN = GET_GLOBALFLAT(udrive_gf->lun);
     cbw.bCBWCBLength = USB_CDB_SIZE;
+    *residue = bytes;
 
     // Transfer cbw to device.
     int ret = usb_msc_send(udrive_gf, USB_DIR_OUT
@@ -93,7 +140,7 @@ usb_cmd_data(struct disk_op_s *op, void *cdbcmd, u16 blocksize)
 
     // Transfer data to/from device.
     if (bytes) {
-        ret = usb_msc_send(udrive_gf, cbw.bmCBWFlags, op->buf_fl, bytes);
+        ret = usb_msc_send(udrive_gf, dir, buf, bytes);
         if (ret)
             goto fail;
     }
@@ -102,24 +149,74 @@ usb_cmd_data(struct disk_op_s *op, void *cdbcmd, u16 blocksize)
     struct csw_s csw;
     ret = usb_msc_send(udrive_gf, USB_DIR_IN
                        , MAKE_FLATPTR(GET_SEG(SS), &csw), sizeof(csw));
-    if (ret)
+    if (ret || csw.dCSWSignature != CSW_SIGNATURE || csw.dCSWTag != tag)
         goto fail;
 
     if (!csw.bCSWStatus)
         return DISK_RET_SUCCESS;
     if (csw.bCSWStatus == 2)
+        // Phase error
         goto fail;
 
-    if (blocksize)
-        op->count -= csw.dCSWDataResidue / blocksize;
+    if (csw.dCSWDataResidue <= bytes)
+        *residue = csw.dCSWDataResidue;
     return DISK_RET_EBADTRACK;
 
 fail:
-    // XXX - reset connection
     dprintf(1, "USB transmission failed\n");
+    usb_msc_reset(udrive_gf);
     return DISK_RET_EBADTRACK;
 }
 
+// Low-level usb command transmit function.  Reads and writes larger
+// than what the drive accepts in one command are split up.
+int
+usb_cmd_data(struct disk_op_s *op, void *cdbcmd, u16 blocksize)
+{
+    if (!CONFIG_USB_MSC)
+        return 0;
+
+    dprintf(16, "usb_cmd_data id=%p write=%d count=%d bs=%d buf=%p\n"
+            , op->drive_gf, 0, op->count, blocksize, op->buf_fl);
+    struct usbdrive_s *udrive_gf = container_of(
+        op->drive_gf, struct usbdrive_s, drive);
+    int dir = cdb_is_read(cdbcmd, blocksize) ? USB_DIR_IN : USB_DIR_OUT;
+    u32 residue;
+
+    struct cdb_rwdata_10 *cmd = cdbcmd;
+    u16 max = GET_GLOBALFLAT(udrive_gf->max_sectors);
+    if (!blocksize || op->count <= max
+        || (cmd->command != CDB_CMD_READ_10
+            && cmd->command != CDB_CMD_WRITE_10)) {
+        int ret = usb_msc_command(udrive_gf, cdbcmd, dir, op->buf_fl
+                                  , blocksize * op->count, &residue);
+        if (ret && blocksize)
+            op->count -= DIV_ROUND_UP(residue, blocksize);
+        return ret;
+    }
+
+    u32 lba = be32_to_cpu(cmd->lba);
+    u16 done = 0;
+    while (done < op->count) {
+        u16 count = op->count - done;
+        if (count > max)
+            count = max;
+        struct cdb_rwdata_10 part;
+        memcpy(&part, cmd, sizeof(part));
+        part.lba = cpu_to_be32(lba + done);
+        part.count = cpu_to_be16(count);
+        int ret = usb_msc_command(udrive_gf, &part, dir
+                                  , op->buf_fl + done * blocksize
+                                  , count * blocksize, &residue);
+        if (ret) {
+            op->count = done + count - DIV_ROUND_UP(residue, blocksize);
+            return ret;
+        }
+        done += count;
+    }
+    return DISK_RET_SUCCESS;
+}
+
 static int
 usb_msc_maxlun(struct usb_pipe *pipe)
 {
@@ -136,9 +233,50 @@ usb_msc_maxlun(struct usb_pipe *pipe)
     return maxlun;
 }
 
+// Most sticks handle transfers of up to 120KB, some much less.
+#define USB_MSC_MAX_SECTORS 240
+
+static const struct usb_msc_quirk_s {
+    u16 vendor, product;
+    u16 max_sectors;
+} usb_msc_quirks[] = {
+    { 0x05e3, 0x0701, 64 }, // Genesys Logic USB to IDE optical
+    { 0x05e3, 0x0702, 64 }, // Genesys Logic USB to IDE disk
+};
+
+// Find the largest number of sectors to read or write with a single
+// command.
+static int
+usb_msc_max_sectors(struct usbdevice_s *usbdev)
+{
+    int max = romfile_loadint("etc/usb-msc-max-sectors", USB_MSC_MAX_SECTORS);
+    if (max <= 0 || max > 0xffff)
+        max = USB_MSC_MAX_SECTORS;
+    struct usb_device_descriptor dinfo;
+    struct usb_ctrlrequest req;
+    req.bRequestType = USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE;
+    req.bRequest = USB_REQ_GET_DESCRIPTOR;
+    req.wValue = USB_DT_DEVICE<<8;
+    req.wIndex = 0;
+    req.wLength = sizeof(dinfo);
+    int ret = send_default_control(usbdev->defpipe, &req, &dinfo);
+    if (ret)
+        return max;
+    int i;
+    for (i=0; i<ARRAY_SIZE(usb_msc_quirks); i++) {
+        const struct usb_msc_quirk_s *q = &usb_msc_quirks[i];
+        if (q->vendor == dinfo.idVendor && q->product == dinfo.idProduct
+            && q->max_sectors < max)
+            max = q->max_sectors;
+    }
+    dprintf(3, "USB MSC %04x:%04x max %d sectors per command\n"
+            , dinfo.idVendor, dinfo.idProduct, max);
+    return max;
+}
+
 static int
 usb_msc_lun_setup(struct usb_pipe *inpipe, struct usb_pipe *outpipe,
-                  struct usbdevice_s *usbdev, int lun)
+                  struct usbdevice_s *usbdev, int lun, int max_sectors)
 {
     // Allocate drive structure.
     struct usbdrive_s *drive = malloc_fseg(sizeof(*drive));
@@ -154,6 +292,9 @@ usb_msc_lun_setup(struct usb_pipe *inpipe, struct usb_pipe *outpipe,
     drive->bulkin = inpipe;
     drive->bulkout = outpipe;
     drive->lun = lun;
+    drive->max_sectors = max_sectors;
+    drive->defpipe = usbdev->defpipe;
+    drive->iface = usbdev->iface->bInterfaceNumber;
 
     int prio = bootprio_find_usb(usbdev, lun);
     int ret = scsi_drive_setup(&drive->drive, "USB MSC", prio);
@@ -201,9 +342,11 @@ usb_msc_setup(struct usbdevice_s *usbdev)
         goto fail;
 
     int maxlun = usb_msc_maxlun(usbdev->defpipe);
+    int max_sectors = usb_msc_max_sectors(usbdev);
     int lun, pipesused = 0;
     for (lun = 0; lun < maxlun + 1; lun++) {
-        int ret = usb_msc_lun_setup(inpipe, outpipe, usbdev, lun);
+        int ret = usb_msc_lun_setup(inpipe, outpipe, usbdev, lun
+                                    , max_sectors);
         if (!ret)
             pipesused = 1;
     }
@@ -211,6 +354,8 @@ usb_msc_setup(struct usbdevice_s *usbdev)
     if (!pipesused)
         goto fail;
 
+    // Keep the control pipe for reset recovery.
+    usbdev->defpipe = NULL;
     return 0;
 fail:
     dprintf(1, "Unable to configure USB MSC device.\n");
@@ -450,6 +450,8 @@ wait_ed(struct ohci_ed *ed)
     }
 }
 
+#define TDALIGN 16
+
 int
 ohci_control(struct usb_pipe *p, int dir, const void *cmd, int cmdsize
              , void *data, int datasize)
@@ -466,12 +468,9 @@ ohci_control(struct usb_pipe *p, int dir, const void *cmd, int cmdsize
     struct usb_ohci_s *cntl = container_of(
         pipe->pipe.cntl, struct usb_ohci_s, usb);
 
-    // Setup transfer descriptors
-    struct ohci_td *tds = malloc_tmphigh(sizeof(*tds) * 3);
-    if (!tds) {
-        warn_noalloc();
-        return -1;
-    }
+    // Setup transfer descriptors (on stack, 16byte aligned)
+    u8 tdsbuf[sizeof(struct ohci_td) * 3 + TDALIGN - 1];
+    struct ohci_td *tds = (void*)ALIGN((u32)tdsbuf, TDALIGN);
     struct ohci_td *td = tds;
     td->hwINFO = TD_DP_SETUP | TD_T_DATA0 | TD_CC;
     td->hwCBP = (u32)cmd;
@@ -502,7 +501,6 @@ ohci_control(struct usb_pipe *p, int dir, const void *cmd, int cmdsize
     pipe->ed.hwINFO |= ED_SKIP;
     if (ret)
         ohci_waittick(cntl);
-    free(tds);
     return ret;
 }
 
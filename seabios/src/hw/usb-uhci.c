@@ -372,10 +372,11 @@ uhci_alloc_pipe(struct usbdevice_s *usbdev
         return usbpipe;
     }
 
-    // Allocate a new queue head.
+    // Allocate a new queue head.  Control pipes may be kept for use
+    // after POST (usb-msc reset recovery), so they can't be temporary.
     struct uhci_pipe *pipe;
     if (eptype == USB_ENDPOINT_XFER_CONTROL)
-        pipe = malloc_tmphigh(sizeof(*pipe));
+        pipe = malloc_high(sizeof(*pipe));
     else
         pipe = malloc_low(sizeof(*pipe));
     if (!pipe) {
@@ -443,6 +444,9 @@ wait_td(struct uhci_td *td)
     return 0;
 }
 
+#define STACKTDS 4
+#define TDALIGN 16
+
 int
 uhci_control(struct usb_pipe *p, int dir, const void *cmd, int cmdsize
              , void *data, int datasize)
@@ -457,52 +461,64 @@ uhci_control(struct usb_pipe *p, int dir, const void *cmd, int cmdsize
     int lowspeed = pipe->pipe.speed;
     int devaddr = pipe->pipe.devaddr | (pipe->pipe.ep << 7);
 
-    // Setup transfer descriptors
-    int count = 2 + DIV_ROUND_UP(datasize, maxpacket);
-    struct uhci_td *tds = malloc_tmphigh(sizeof(*tds) * count);
-    if (!tds) {
-        warn_noalloc();
-        return -1;
-    }
+    // Allocate 4 tds on stack (16byte aligned) and use them as a ring
+    // for the setup, data, and status stages.
+    u8 tdsbuf[sizeof(struct uhci_td) * STACKTDS + TDALIGN - 1];
+    struct uhci_td *tds = (void*)ALIGN((u32)tdsbuf, TDALIGN);
+    memset(tds, 0, sizeof(*tds) * STACKTDS);
+
+    // Enable tds
+    barrier();
+    pipe->qh.element = (u32)tds;
 
-    tds[0].link = (u32)&tds[1] | UHCI_PTR_DEPTH;
-    tds[0].status = (uhci_maxerr(3) | (lowspeed ? TD_CTRL_LS : 0)
-                     | TD_CTRL_ACTIVE);
-    tds[0].token = (uhci_explen(cmdsize) | (devaddr << TD_TOKEN_DEVADDR_SHIFT)
-                    | USB_PID_SETUP);
-    tds[0].buffer = (void*)cmd;
+    int count = 2 + DIV_ROUND_UP(datasize, maxpacket);
     int toggle = TD_TOKEN_TOGGLE;
     int i;
-    for (i=1; i<count-1; i++) {
-        tds[i].link = (u32)&tds[i+1] | UHCI_PTR_DEPTH;
-        tds[i].status = (uhci_maxerr(3) | (lowspeed ? TD_CTRL_LS : 0)
-                         | TD_CTRL_ACTIVE);
-        int len = (i == count-2 ? (datasize - (i-1)*maxpacket) : maxpacket);
-        tds[i].token = (uhci_explen(len) | toggle
-                        | (devaddr << TD_TOKEN_DEVADDR_SHIFT)
-                        | (dir ? USB_PID_IN : USB_PID_OUT));
-        tds[i].buffer = data + (i-1) * maxpacket;
-        toggle ^= TD_TOKEN_TOGGLE;
+    for (i=0; i<count; i++) {
+        struct uhci_td *td = &tds[i % STACKTDS];
+        int ret = wait_td(td);
+        if (ret)
+            goto fail;
+
+        struct uhci_td *nexttd = &tds[(i+1) % STACKTDS];
+        td->link = (i==count-1 ? UHCI_PTR_TERM
+                    : (u32)nexttd | UHCI_PTR_DEPTH);
+        u32 status = (uhci_maxerr(3) | (lowspeed ? TD_CTRL_LS : 0)
+                      | TD_CTRL_ACTIVE);
+        if (!i) {
+            // Setup stage
+            td->token = (uhci_explen(cmdsize)
+                         | (devaddr << TD_TOKEN_DEVADDR_SHIFT)
+                         | USB_PID_SETUP);
+            td->buffer = (void*)cmd;
+        } else if (i == count-1) {
+            // Status stage
+            status = (uhci_maxerr(0) | (lowspeed ? TD_CTRL_LS : 0)
+                      | TD_CTRL_ACTIVE);
+            td->token = (uhci_explen(0) | TD_TOKEN_TOGGLE
+                         | (devaddr << TD_TOKEN_DEVADDR_SHIFT)
+                         | (dir ? USB_PID_OUT : USB_PID_IN));
+            td->buffer = 0;
+        } else {
+            // Data stage
+            int len = (i == count-2 ? (datasize - (i-1)*maxpacket) : maxpacket);
+            td->token = (uhci_explen(len) | toggle
+                         | (devaddr << TD_TOKEN_DEVADDR_SHIFT)
+                         | (dir ? USB_PID_IN : USB_PID_OUT));
+            td->buffer = data + (i-1) * maxpacket;
+            toggle ^= TD_TOKEN_TOGGLE;
+        }
+        barrier();
+        td->status = status;
     }
-    tds[i].link = UHCI_PTR_TERM;
-    tds[i].status = (uhci_maxerr(0) | (lowspeed ? TD_CTRL_LS : 0)
-                     | TD_CTRL_ACTIVE);
-    tds[i].token = (uhci_explen(0) | TD_TOKEN_TOGGLE
-                    | (devaddr << TD_TOKEN_DEVADDR_SHIFT)
-                    | (dir ? USB_PID_OUT : USB_PID_IN));
-    tds[i].buffer = 0;
-
-    // Transfer data
-    barrier();
-    pipe->qh.element = (u32)&tds[0];
-    int ret = wait_pipe(pipe, 500);
-    free(tds);
-    return ret;
+    return wait_pipe(pipe, 500);
+fail:
+    dprintf(1, "uhci_control failed\n");
+    pipe->qh.element = UHCI_PTR_TERM;
+    uhci_waittick(pipe->iobase);
+    return -1;
 }
 
-#define STACKTDS 4
-#define TDALIGN 16
-
 int
 uhci_send_bulk(struct usb_pipe *p, int dir, void *data, int datasize)
 {
@@ -560,6 +576,15 @@ fail:
     return -1;
 }
 
+void
+uhci_reset_toggle(struct usb_pipe *p)
+{
+    if (! CONFIG_USB_UHCI)
+        return;
+    struct uhci_pipe *pipe = container_of(p, struct uhci_pipe, pipe);
+    pipe->toggle = 0;
+}
+
 int
 uhci_poll_intr(struct usb_pipe *p, void *data)
 {
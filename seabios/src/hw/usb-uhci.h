@@ -12,6 +12,7 @@ int uhci_control(struct usb_pipe *p, int dir, const void *cmd, int cmdsize
                  , void *data, int datasize);
 int uhci_send_bulk(struct usb_pipe *p, int dir, void *data, int datasize);
 int uhci_poll_intr(struct usb_pipe *p, void *data);
+void uhci_reset_toggle(struct usb_pipe *p);
 
 
 /****************************************************************
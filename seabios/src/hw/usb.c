@@ -8,6 +8,7 @@
 #include "config.h" // CONFIG_*
 #include "malloc.h" // free
 #include "output.h" // dprintf
+#include "pci.h" // struct pci_device
 #include "string.h" // memset
 #include "usb.h" // struct usb_s
 #include "usb-ehci.h" // ehci_setup
@@ -95,6 +96,25 @@ usb_send_bulk(struct usb_pipe *pipe_fl, int dir, void *data, int datasize)
     }
 }
 
+// Restart the data toggle of a pipe at DATA0 (after an endpoint halt
+// was cleared).  OHCI starts every bulk transfer from the pipe's ed,
+// so only EHCI and UHCI track it across transfers here.
+void
+usb_reset_toggle(struct usb_pipe *pipe)
+{
+    ASSERT32FLAT();
+    switch (pipe->type) {
+    case USB_TYPE_UHCI:
+        uhci_reset_toggle(pipe);
+        break;
+    case USB_TYPE_EHCI:
+        ehci_reset_toggle(pipe);
+        break;
+    default:
+        break;
+    }
+}
+
 int
 usb_poll_intr(struct usb_pipe *pipe_fl, void *data)
 {
@@ -391,11 +411,17 @@ usb_hub_port_setup(void *data)
     struct usbhub_s *hub = usbdev->hub;
     u32 port = usbdev->port;
 
+    if (boot_probe_abandoned())
+        goto done;
+
     // Detect if device present (and possibly start reset)
     int ret = hub->op->detect(hub, port);
-    if (ret)
+    if (ret || boot_probe_abandoned())
         // No device present
         goto done;
+    if (!hub->usbdev)
+        // Root hub port
+        presence_usb_found(hub->cntl->pci->bdf, port);
 
     // Reset port and determine device speed
     mutex_lock(&hub->cntl->resetlock);
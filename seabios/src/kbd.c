@@ -6,6 +6,7 @@
 // This file may be distributed under the terms of the GNU LGPLv3 license.
 
 #include "biosvar.h" // GET_BDA
+#include "block.h" // disk_write_idle
 #include "bregs.h" // struct bregs
 #include "config.h" // CONFIG_*
 #include "hw/ps2port.h" // ps2_kbd_command
@@ -273,6 +274,8 @@ handle_16(struct bregs *regs)
     // XXX - set_leds should be called from irq handler
     set_leds();
 
+    disk_write_idle();
+
     switch (regs->ah) {
     case 0x00: handle_1600(regs); break;
     case 0x01: handle_1601(regs); break;
@@ -117,6 +117,7 @@ interface_init(void)
     // Setup romfile items.
     qemu_cfg_init();
     coreboot_cbfs_init();
+    coreboot_timestamp(TS_SEABIOS_CBFS_INIT);
 
     // Setup ivt/bda/ebda
     ivt_init();
@@ -136,12 +137,14 @@ interface_init(void)
 void
 device_hardware_setup(void)
 {
+    coreboot_timestamp(TS_SEABIOS_DEVICE_SETUP);
     usb_setup();
     ps2port_setup();
     lpt_setup();
     serial_setup();
 
     floppy_setup();
+    disk_cache_setup();
     ata_setup();
     ahci_setup();
     cbfs_payload_setup();
@@ -167,11 +170,15 @@ platform_hardware_setup(void)
     pic_setup();
     mathcp_setup();
     timer_setup();
+    // Profiling can only start once the timer is calibrated.
+    profile_init();
+    u32 start = profile_start();
     clock_setup();
 
     // Platform specific setup
     qemu_platform_setup();
     coreboot_platform_setup();
+    profile_phase("platform_hardware_setup", start);
 }
 
 void
@@ -203,16 +210,18 @@ startBoot(void)
     struct bregs br;
     memset(&br, 0, sizeof(br));
     br.flags = F_IF;
+    coreboot_timestamp(TS_SEABIOS_BOOT);
     call16_int(0x19, &br);
 }
 
 // Init 8042 controller if PS/2 keyboard is not present and USB keyboard is present.
-extern int has_ps2_keyboard;
 extern void force_init_8042_for_usb_kbd(void);
 static void
 init_8042_if_usb_kbd(void)
 {
     wait_threads();
+    if (threads_during_optionroms())
+        coreboot_timestamp(TS_SEABIOS_DEVICES_DONE);
     if ((!has_ps2_keyboard) && usb_kbd_active())
     {
         dprintf(1, "USB keyboard only, force init 8042 controller.\n");
@@ -230,27 +239,56 @@ maininit(void)
     // Setup platform devices.
     platform_hardware_setup();
 
+    struct bios_settings s;
+    memset(&s, 0, sizeof(s));
+    load_bios_settings(&s);
+    disk_write_cache_setup(s.disk_write_cache);
+    presence_load();
+
     // Start hardware initialization (if threads allowed during optionroms)
-    if (threads_during_optionroms())
+    u32 start = profile_start();
+    if (threads_during_optionroms()) {
+        // Play the boot tune while the hardware is probed.
+        play_boot_tune(s.boot_tune);
         device_hardware_setup();
+        profile_phase("device_hardware_setup", start);
+    }
 
     // Run vga option rom
+    start = profile_start();
     vgarom_setup();
+    profile_phase("vgarom_setup", start);
 
     // Do hardware initialization (if running synchronously)
     if (!threads_during_optionroms()) {
+        start = profile_start();
+        // Threads don't run during the option roms, so start the tune
+        // after the vga rom and silence it before the other roms.
+        play_boot_tune(s.boot_tune);
         device_hardware_setup();
-        wait_threads();
+        boot_wait_probes();
+        stop_boot_tune();
+        profile_phase("device_hardware_setup", start);
+        coreboot_timestamp(TS_SEABIOS_DEVICES_DONE);
     }
 
     // Run option roms
+    coreboot_timestamp(TS_SEABIOS_START_OPTIONROMS);
+    start = profile_start();
     optionrom_setup();
+    profile_phase("optionrom_setup", start);
+    coreboot_timestamp(TS_SEABIOS_END_OPTIONROMS);
 
     init_8042_if_usb_kbd();
 
     // Allow user to modify overall boot order.
+    coreboot_timestamp(TS_SEABIOS_START_BOOTMENU);
     interactive_bootmenu();
     wait_threads();
+    coreboot_timestamp(TS_SEABIOS_END_BOOTMENU);
+    if (!boot_probe_abandoned())
+        presence_save();
+    profile_dump();
 
     // Prepare for boot.
     prepareboot();
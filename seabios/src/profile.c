@@ -0,0 +1,121 @@
+// Boot time profiling of POST phases and threads.
+//
+// Copyright (C) 2026  TinyLlama BIOS contributors
+//
+// This file may be distributed under the terms of the GNU LGPLv3 license.
+
+#include "biosvar.h" // GET_GLOBAL
+#include "config.h" // CONFIG_BOOT_PROFILE
+#include "malloc.h" // malloc_high
+#include "output.h" // dprintf
+#include "string.h" // memset
+#include "util.h" // timer_read
+
+// Each profiled POST phase and each thread started by run_thread()
+// gets an entry with its start time and wall time.  Threads also
+// record the time they actually ran and how often they yielded.  All
+// times are in microseconds since profile_init().  The table stays in
+// high memory after boot and is dumped to the debug log before boot.
+#define PROFILE_ENTRIES 64
+
+struct profile_entry {
+    const char *name;   // POST phase - NULL for threads
+    void *func;         // thread function
+    u32 start;
+    u32 wall;
+    u32 cpu;            // threads only
+    u32 yields;         // threads only
+};
+
+static struct profile_entry *ProfileTable;
+static int ProfileCount;
+static u32 ProfileBase;
+
+void
+profile_init(void)
+{
+    if (!CONFIG_BOOT_PROFILE)
+        return;
+    ProfileTable = malloc_high(PROFILE_ENTRIES * sizeof(*ProfileTable));
+    if (!ProfileTable) {
+        warn_noalloc();
+        return;
+    }
+    memset(ProfileTable, 0, PROFILE_ENTRIES * sizeof(*ProfileTable));
+    ProfileBase = timer_read();
+}
+
+// Return the current time for profile_phase().
+u32
+profile_start(void)
+{
+    if (!CONFIG_BOOT_PROFILE)
+        return 0;
+    return timer_read();
+}
+
+// Convert timer ticks (the scaled TSC if there is one) to microseconds.
+static u32
+profile_usec(u32 ticks)
+{
+    extern u32 TimerKHz;
+    u32 khz = GET_GLOBAL(TimerKHz);
+    return (ticks / khz) * 1000 + (ticks % khz) * 1000 / khz;
+}
+
+static struct profile_entry *
+profile_add(u32 start, u32 end)
+{
+    if (!ProfileTable || ProfileCount >= PROFILE_ENTRIES)
+        return NULL;
+    struct profile_entry *e = &ProfileTable[ProfileCount++];
+    e->start = profile_usec(start - ProfileBase);
+    e->wall = profile_usec(end - start);
+    return e;
+}
+
+// Record a POST phase that started at 'start'.
+void
+profile_phase(const char *name, u32 start)
+{
+    if (!CONFIG_BOOT_PROFILE)
+        return;
+    struct profile_entry *e = profile_add(start, timer_read());
+    if (e)
+        e->name = name;
+}
+
+// Record a finished thread.
+void
+profile_thread(void *func, u32 start, u32 cpu, u32 yields)
+{
+    if (!CONFIG_BOOT_PROFILE)
+        return;
+    struct profile_entry *e = profile_add(start, timer_read());
+    if (!e)
+        return;
+    e->func = func;
+    e->cpu = profile_usec(cpu);
+    e->yields = yields;
+}
+
+void
+profile_dump(void)
+{
+    if (!CONFIG_BOOT_PROFILE || !ProfileTable)
+        return;
+    dprintf(1, "Boot profile (%d entries at %p, times in us):\n"
+            , ProfileCount, ProfileTable);
+    int i;
+    for (i = 0; i < ProfileCount; i++) {
+        if (ProfileTable[i].name)
+            dprintf(1, "  phase %s: start %u wall %u\n"
+                    , ProfileTable[i].name, ProfileTable[i].start
+                    , ProfileTable[i].wall);
+        else
+            dprintf(1, "  thread %p: start %u wall %u cpu %u yields %u\n"
+                    , ProfileTable[i].func, ProfileTable[i].start
+                    , ProfileTable[i].wall, ProfileTable[i].cpu
+                    , ProfileTable[i].yields);
+    }
+}
@@ -12,12 +12,29 @@
 
 static struct romfile_s *RomfileRoot VARVERIFY32INIT;
 
+// Files are also chained into a hash table by name so that
+// romfile_find() doesn't have to compare against every file.
+#define ROMFILE_HASH_SIZE 64
+static struct romfile_s *RomfileHash[ROMFILE_HASH_SIZE] VARVERIFY32INIT;
+
+static u32
+romfile_hash(const char *name)
+{
+    u32 hash = 5381;
+    while (*name)
+        hash = hash * 33 + *name++;
+    return hash % ROMFILE_HASH_SIZE;
+}
+
 void
 romfile_add(struct romfile_s *file)
 {
     dprintf(3, "Add romfile: %s (size=%d)\n", file->name, file->size);
     file->next = RomfileRoot;
     RomfileRoot = file;
+    u32 hash = romfile_hash(file->name);
+    file->hashnext = RomfileHash[hash];
+    RomfileHash[hash] = file;
 }
 
 // Search for the specified file.
@@ -44,7 +61,13 @@ romfile_findprefix(const char *prefix, struct romfile_s *prev)
 struct romfile_s *
 romfile_find(const char *name)
 {
-    return __romfile_findprefix(name, strlen(name) + 1, NULL);
+    struct romfile_s *cur = RomfileHash[romfile_hash(name)];
+    while (cur) {
+        if (strcmp(name, cur->name) == 0)
+            return cur;
+        cur = cur->hashnext;
+    }
+    return NULL;
 }
 
 // Helper function to find, malloc_tmphigh, and copy a romfile.  This
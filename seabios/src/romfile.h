@@ -5,7 +5,7 @@
 
 // romfile.c
 struct romfile_s {
-    struct romfile_s *next;
+    struct romfile_s *next, *hashnext;
     char name[128];
     u32 size;
     int (*copy)(struct romfile_s *file, void *dest, u32 maxlen);
@@ -34,6 +34,7 @@
  *  - Order number: 231244-006
  */
 
+#include "stacks.h"
 #include "x86.h"
 #include "util.h"
 
@@ -82,66 +83,112 @@ static void speaker_disable(void) {
 	outb(inb(PC_SPEAKER_PORT) & 0xfc, PC_SPEAKER_PORT);
 }
 
+/*
+ * Boot tunes are note tables played from a thread, so the melody runs
+ * while the rest of POST carries on. Without CONFIG_THREADS the thread
+ * runs synchronously and the tune blocks as it always did.
+ */
+struct note {
+	u16 freq;	/* 0 for a rest. */
+	u16 duration;	/* In milliseconds, 0 ends the tune. */
+};
+
+static const struct note mushroom_tune[] = {
+	{ 523, 38 },	/* C5 */
+	{ 392, 38 },	/* G4 */
+	{ 523, 38 },	/* C5 */
+	{ 659, 38 },	/* E5 */
+	{ 784, 38 },	/* G5 */
+	{ 1047, 38 },	/* C6 */
+	{ 784, 38 },	/* G5 */
+	{ 415, 38 },	/* G#4 */
+	{ 523, 38 },	/* C5 */
+	{ 622, 38 },	/* D#5 */
+	{ 830, 38 },	/* G#5 */
+	{ 622, 38 },	/* D#5 */
+	{ 830, 38 },	/* G#5 */
+	{ 1047, 38 },	/* C6 */
+	{ 1245, 38 },	/* D#6 */
+	{ 1661, 38 },	/* G#6 */
+	{ 1245, 38 },	/* D#6 */
+	{ 932, 38 },	/* A#5 */
+	{ 1175, 38 },	/* D6 */
+	{ 1397, 38 },	/* F6 */
+	{ 1865, 38 },	/* A#6 */
+	{ 1397, 38 },	/* F6 */
+	{ 1865, 38 },	/* A#6 */
+	{ 2349, 38 },	/* D7 */
+	{ 2794, 38 },	/* F7 */
+	{ 3729, 38 },	/* A#7 */
+	{ 2794, 38 },	/* F7 */
+	{ 0, 0 }
+};
+
+static const struct note ducks_tune[] = {
+	{ 784, 40 },	/* G5 */
+	{ 0, 40 },
+	{ 784, 40 },	/* G5 */
+	{ 0, 40 },
+	{ 622, 40 },	/* D#5 */
+	{ 0, 40 + 80 },
+	{ 622, 40 },	/* D#5 */
+	{ 0, 40 + 80 },
+	{ 466, 40 },	/* A#4 */
+	{ 0, 40 },
+	{ 466, 40 },	/* A#4 */
+	{ 0, 40 },
+	{ 466, 40 },	/* A#4 */
+	{ 0, 40 + 80 },
+	{ 622, 40 },	/* D#5 */
+	{ 0, 40 + 80 },
+	{ 523, 40 },	/* C5 */
+	{ 0, 0 }
+};
+
+/* Set by stop_boot_tune() to end the tune early. */
+static int tune_stopped;
+
 /**
- * Use the PC speaker to create a tone/beep of the specified frequency
- * and duration.
+ * Play a note table, yielding to other threads for the length of each
+ * note instead of busy waiting.
  *
- * @param freq The frequency of the tone/beep.
- * @param duration The duration of the tone/beep in milliseconds.
+ * @param data The note table, terminated by a zero duration entry.
  */
-static void speaker_tone(u16 freq, unsigned int duration) {
-	speaker_enable(freq);
-	mdelay(duration);
-	speaker_disable();
+static void tune_thread(void *data) {
+	const struct note *n;
+
+	for (n = data; n->duration && !tune_stopped; n++) {
+		if (n->freq)
+			speaker_enable(n->freq);
+		u32 end = timer_calc(n->duration);
+		while (!timer_check(end))
+			yield();
+		speaker_disable();
+	}
 }
 
-void play_ducks_tune(void) {
-  speaker_tone(784, 40); // G5
-  mdelay(40);
-  speaker_tone(784, 40); // G5
-  mdelay(40);
-  speaker_tone(622, 40); // D#5
-  mdelay(40 + 80);
-  speaker_tone(622, 40); // D#5
-  mdelay(40 + 80);
-  speaker_tone(466, 40); // A#4
-  mdelay(40);
-  speaker_tone(466, 40); // A#4
-  mdelay(40);
-  speaker_tone(466, 40); // A#4
-  mdelay(40 + 80);
-  speaker_tone(622, 40); // D#5
-  mdelay(40 + 80);
-  speaker_tone(523, 40); // C5
+/**
+ * Start playing the boot tune selected in the BIOS settings.
+ *
+ * @param tune 1 for the mushroom tune, 2 for the ducks tune, anything
+ *             else plays nothing.
+ */
+void play_boot_tune(int tune) {
+	const struct note *notes;
+
+	if (tune == 1)
+		notes = mushroom_tune;
+	else if (tune == 2)
+		notes = ducks_tune;
+	else
+		return;
+	run_thread(tune_thread, (void *)notes);
 }
 
-void play_mushroom_tune(void) {
-  int duration = 38;
-  speaker_tone(523,  duration); // C5
-  speaker_tone(392,  duration); // G4
-  speaker_tone(523,  duration); // C5
-  speaker_tone(659,  duration); // E5
-  speaker_tone(784,  duration); // G5
-  speaker_tone(1047, duration); // C6
-  speaker_tone(784,  duration); // G5
-  speaker_tone(415,  duration); // G#4
-  speaker_tone(523,  duration); // C5
-  speaker_tone(622,  duration); // D#5
-  speaker_tone(830,  duration); // G#5
-  speaker_tone(622,  duration); // D#5
-  speaker_tone(830,  duration); // G#5
-  speaker_tone(1047, duration); // C6
-  speaker_tone(1245, duration); // D#6
-  speaker_tone(1661, duration); // G#6
-  speaker_tone(1245, duration); // D#6
-  speaker_tone(932,  duration); // A#5
-  speaker_tone(1175, duration); // D6
-  speaker_tone(1397, duration); // F6
-  speaker_tone(1865, duration); // A#6
-  speaker_tone(1397, duration); // F6
-  speaker_tone(1865, duration); // A#6
-  speaker_tone(2349, duration); // D7
-  speaker_tone(2794, duration); // F7
-  speaker_tone(3729, duration); // A#7
-  speaker_tone(2794, duration); // F7
-}
\ No newline at end of file
+/**
+ * Stop the boot tune and silence the note being played.
+ */
+void stop_boot_tune(void) {
+	tune_stopped = 1;
+	speaker_disable();
+}
@@ -6,6 +6,13 @@
 #define SPI_ROM_SIZE     8L * 1024 * 1024
 #define SPI_SECTOR_SIZE  4096
 #define SPI_PAGE_SIZE    256
+// The chipset decodes the top of the flash part (the coreboot ROM) just
+// below 4G, so its end is at 0xFFFFFFFF.
+#define SPI_MAPPED_SIZE  (2L * 1024 * 1024)
+#define SPI_MAPPED_BASE  ((u32)(0x100000000LL - SPI_ROM_SIZE))
+// Worst case WIP times (in ms) of the supported parts, with some margin.
+#define SPI_PROGRAM_TIMEOUT 20
+#define SPI_ERASE_TIMEOUT   1000
 
 const u32 spi_sector_size          = SPI_SECTOR_SIZE;
 const u32 spi_page_size            = SPI_PAGE_SIZE;
@@ -47,15 +54,27 @@ typedef struct flash_info {
     u8 id[3];
     const char *name;
     u32 size;
+    u32 page_size;
+    u8 erase_opcode;  // 4 KB sector erase
+    u8 read_opcode;
+    u8 read_dummy;    // dummy bytes after the address
 } flash_info;
 
+// Parts that don't describe themselves via SFDP.
 static const flash_info flash_info_table[] = {
-    {{0xc2, 0x20, 0x12}, "MX25L2005", 256L * 1024},
-    {{0xc2, 0x20, 0x15}, "MX25L1605", 2L * 1024 * 1024},
-    {{0xc2, 0x25, 0x37}, "MX25U6435F", 8L * 1024 * 1024},
-    {{0xc2, 0x25, 0x38}, "MX25U12835F", 16L * 1024 * 1024}
+    {{0xc2, 0x20, 0x12}, "MX25L2005", 256L * 1024, 256, 0x20, 0x0B, 1},
+    {{0xc2, 0x20, 0x15}, "MX25L1605", 2L * 1024 * 1024, 256, 0x20, 0x0B, 1},
+    {{0xc2, 0x25, 0x37}, "MX25U6435F", 8L * 1024 * 1024, 256, 0x20, 0x0B, 1},
+    {{0xc2, 0x25, 0x38}, "MX25U12835F", 16L * 1024 * 1024, 256, 0x20, 0x0B, 1}
 };
 
+// Parameters of the detected part.  Until it is known only use the
+// plain READ command, which every part supports at any clock.
+static flash_info flash = {
+    {0, 0, 0}, NULL, SPI_ROM_SIZE, SPI_PAGE_SIZE, 0x20, 0x03, 0
+};
+static int flash_probed = 0;
+
 static const int flash_info_table_size = sizeof(flash_info_table) / sizeof(flash_info_table[0]);
 
 static const flash_info *get_flash_info(u8 id[3]) {
@@ -79,6 +98,73 @@ static void read_flash_device_id(u8 *p) {
     disable_cs(spi_base);
 }
 
+static void read_sfdp(u32 addr, u8 *buf, u32 len) {
+    u32 i;
+
+    enable_cs(spi_base);
+    write_spi_byte(spi_base, 0x5A); //RDSFDP
+    write_spi_24bit_addr(spi_base, addr);
+    write_spi_byte(spi_base, 0); //dummy cycles
+    for (i = 0; i < len; i++)
+        buf[i] = read_spi_byte(spi_base);
+    disable_cs(spi_base);
+}
+
+// Fill in 'fi' from the JEDEC basic flash parameter table (JESD216).
+static int probe_sfdp(flash_info *fi) {
+    u8 hdr[16];
+    u32 dw[16];
+
+    read_sfdp(0, hdr, sizeof(hdr));
+    if (memcmp(hdr, "SFDP", 4) != 0)
+        return -1;
+    // The first parameter header always describes the basic table.
+    u8 *ph = hdr + 8;
+    u32 dwords = ph[3];
+    u32 ptr = ph[4] | (ph[5] << 8) | (ph[6] << 16);
+    if (ph[0] != 0x00 || dwords < 9)
+        return -1;
+    if (dwords > ARRAY_SIZE(dw))
+        dwords = ARRAY_SIZE(dw);
+    memset(dw, 0, sizeof(dw));
+    read_sfdp(ptr, (u8*)dw, dwords * 4);
+
+    // Only 3 byte addressing is supported by the controller.
+    if (((dw[0] >> 17) & 3) == 2)
+        return -1;
+    // 4 KB erase opcode, either in DWORD 1 or one of the erase types.
+    fi->erase_opcode = 0;
+    if ((dw[0] & 3) == 1)
+        fi->erase_opcode = (dw[0] >> 8) & 0xFF;
+    int i;
+    for (i = 0; i < 4 && !fi->erase_opcode; i++) {
+        u16 et = dw[7 + i / 2] >> (16 * (i % 2));
+        if ((et & 0xFF) == 12)
+            fi->erase_opcode = et >> 8;
+    }
+    if (!fi->erase_opcode)
+        return -1;
+
+    if (dw[1] & 0x80000000)
+        fi->size = 1L << ((dw[1] & 0x7FFFFFFF) - 3);
+    else
+        fi->size = (dw[1] + 1) / 8;
+    if (dwords >= 11 && (dw[10] >> 4) & 0x0F)
+        fi->page_size = 1 << ((dw[10] >> 4) & 0x0F);
+    else
+        fi->page_size = (dw[0] & 4) ? 64 : 1;
+    if (fi->page_size > SPI_PAGE_SIZE)
+        fi->page_size = SPI_PAGE_SIZE;
+
+    // The controller shifts one bit at a time, so the dual/quad read
+    // modes advertised in DWORD 1 can't be used; FAST READ (one dummy
+    // byte) is the fastest command, and is required by SFDP.
+    fi->read_opcode = 0x0B;
+    fi->read_dummy = 1;
+    fi->name = "SFDP";
+    return 0;
+}
+
 static void set_flash_writable(void) {
     reg_sb_c4 = nbsb_read8(vx86ex_sb, 0xC4);
     reg_nb_40 = nbsb_read32(vx86ex_nb, 0x40);
@@ -97,106 +183,179 @@ static void set_flash_unwritable(void) {
     nbsb_write8(vx86ex_sb, 0xC4, reg_sb_c4);
 }
 
-void spi_flash_write_byte(u32 in_addr, u8 in_value) {
+// Poll the status register (with a single RDSR command) until the
+// write in progress bit clears or 'timeout' ms have passed.
+static int wait_wip(u16 iobase, u32 timeout) {
     u8 s;
     int wip_cnt = 0;
+    int ret = 0;
+    u32 end = timer_calc(timeout);
 
-    set_flash_writable();
-
-    //mxic write enable
-    enable_cs(spi_base);
-    write_spi_byte(spi_base, 0x06);
-    disable_cs(spi_base);
-
-    //write data
-    enable_cs(spi_base);
-    write_spi_byte(spi_base, 0x02); //PAGE PROGRAM
-    write_spi_24bit_addr(spi_base, in_addr); //address
-    write_spi_byte(spi_base, in_value);
-    disable_cs(spi_base);
-
-    //wait wip
-    enable_cs(spi_base);
-    write_spi_byte(spi_base, 0x05); //RDSR
+    enable_cs(iobase);
+    write_spi_byte(iobase, 0x05); //RDSR
     while (1) {
-        s = read_spi_byte(spi_base);
+        s = read_spi_byte(iobase);
         if ((s & 1) == 0) { //WIP == 0
             wip_cnt++;
             if (wip_cnt >= 3) break;
         } else {
             wip_cnt = 0;
+            if (timer_check(end)) {
+                warn_timeout();
+                ret = -1;
+                break;
+            }
         }
     }
-    disable_cs(spi_base);
+    disable_cs(iobase);
+    return ret;
+}
 
+static void write_enable(u16 iobase) {
+    //mxic write enable
+    enable_cs(iobase);
+    write_spi_byte(iobase, 0x06);
+    disable_cs(iobase);
+}
+
+static void write_disable(u16 iobase) {
     //mxic write disable
-    enable_cs(spi_base);
-    write_spi_byte(spi_base, 0x04);
-    disable_cs(spi_base);
+    enable_cs(iobase);
+    write_spi_byte(iobase, 0x04);
+    disable_cs(iobase);
+}
+
+static void spi_flash_probe(void);
+
+// Program up to one page (256 bytes) with a single PAGE PROGRAM command.
+// The range must not cross a page boundary, or the chip wraps around.
+int spi_flash_program_page(u32 in_addr, const u8 *buf, u32 len) {
+    u32 i;
 
+    if (!len)
+        return 0;
+    if ((in_addr % SPI_PAGE_SIZE) + len > SPI_PAGE_SIZE) {
+        dprintf(1, "SPI page program of %d bytes at %x crosses a page\n"
+                , len, in_addr);
+        return -1;
+    }
+
+    spi_flash_probe();
+    int ret = 0;
+    set_flash_writable();
+    while (len && !ret) {
+        // Parts with smaller pages need several PAGE PROGRAM commands.
+        u32 count = flash.page_size - (in_addr % flash.page_size);
+        if (count > len)
+            count = len;
+
+        write_enable(spi_base);
+        enable_cs(spi_base);
+        write_spi_byte(spi_base, 0x02); //PAGE PROGRAM
+        write_spi_24bit_addr(spi_base, in_addr); //address
+        for (i = 0; i < count; i++)
+            write_spi_byte(spi_base, buf[i]);
+        disable_cs(spi_base);
+
+        ret = wait_wip(spi_base, SPI_PROGRAM_TIMEOUT);
+        in_addr += count;
+        buf += count;
+        len -= count;
+    }
+    write_disable(spi_base);
     set_flash_unwritable();
+    return ret;
 }
 
-void spi_flash_erase_sector(u32 in_addr) {
-    u8 s;
-    int wip_cnt = 0;
+void spi_flash_write_byte(u32 in_addr, u8 in_value) {
+    spi_flash_program_page(in_addr, &in_value, 1);
+}
 
+int spi_flash_erase_sector(u32 in_addr) {
+    spi_flash_probe();
     set_flash_writable();
-
-    //mxic write enable
-    enable_cs(spi_base);
-    write_spi_byte(spi_base, 0x06);
-    disable_cs(spi_base);
+    write_enable(spi_base);
 
     //reset command and address
     enable_cs(spi_base);
-    write_spi_byte(spi_base, 0x20);
+    write_spi_byte(spi_base, flash.erase_opcode); //SECTOR ERASE (4 KB)
     write_spi_24bit_addr(spi_base, in_addr);
     disable_cs(spi_base);
 
-    //wait wip
-    enable_cs(spi_base);
-    write_spi_byte(spi_base, 0x05); //RDSR
-    while(1) {
-        s = read_spi_byte(spi_base);
-        if ((s & 1) == 0) { //WIP == 0
-            wip_cnt ++;
-            if (wip_cnt >= 3) break;
-        } else {
-            wip_cnt = 0;
-        }
-    }
-    disable_cs(spi_base);
-
-    //mxic write disable
-    enable_cs(spi_base);
-    write_spi_byte(spi_base, 0x04);
-    disable_cs(spi_base);
-
+    int ret = wait_wip(spi_base, SPI_ERASE_TIMEOUT);
+    write_disable(spi_base);
     set_flash_unwritable();
+    return ret;
 }
 
-u8 spi_flash_read_byte(u32 in_addr) {
-    u8 value;
+// Read 'len' bytes with a single READ / FAST READ command - the chip
+// keeps incrementing the address for as long as chip select stays low.
+void spi_flash_read(u32 in_addr, u8 *buf, u32 len) {
+    u32 i;
+
+    spi_flash_probe();
     set_flash_writable();
     enable_cs(spi_base);
-    write_spi_byte(spi_base, 0x03); //READ
+    write_spi_byte(spi_base, flash.read_opcode);
     write_spi_24bit_addr(spi_base, in_addr); //address
-    value = read_spi_byte(spi_base);
+    for (i = 0; i < flash.read_dummy; i++)
+        write_spi_byte(spi_base, 0); //dummy cycles
+    for (i = 0; i < len; i++)
+        buf[i] = read_spi_byte(spi_base);
     disable_cs(spi_base);
     set_flash_unwritable();
+}
+
+// Read flash contents via the memory mapped window when the range is
+// decoded, otherwise fall back to command mode.  Data programmed during
+// this boot may still be cached, so callers must tolerate seeing the
+// contents from before the last write.
+void spi_flash_read_mapped(u32 in_addr, u8 *buf, u32 len) {
+    if (in_addr >= SPI_ROM_SIZE - SPI_MAPPED_SIZE
+        && in_addr + len <= SPI_ROM_SIZE && in_addr + len >= in_addr) {
+        iomemcpy(buf, (void*)(SPI_MAPPED_BASE + in_addr), len);
+        return;
+    }
+    spi_flash_read(in_addr, buf, len);
+}
+
+u8 spi_flash_read_byte(u32 in_addr) {
+    u8 value;
+    spi_flash_read(in_addr, &value, 1);
     return value;
 }
 
-int get_spi_flash_info(void) {
-    set_flash_writable();
+// Identify the flash part - from its SFDP tables if it has them,
+// otherwise from flash_info_table.
+static void spi_flash_probe(void) {
+    if (flash_probed)
+        return;
+    flash_probed = 1;
+
     u8 id[3];
+    flash_info fi = flash;
+    set_flash_writable();
     read_flash_device_id(id);
+    int ret = probe_sfdp(&fi);
     set_flash_unwritable();
 
+    if (ret == 0) {
+        memcpy(fi.id, id, 3);
+        flash = fi;
+        return;
+    }
     const flash_info *pfi = get_flash_info(id);
-    if (pfi != NULL) {
-        dprintf(1, "Found SPI flash chip: %s, size: %d\n", pfi->name, pfi->size);
+    if (pfi != NULL)
+        flash = *pfi;
+}
+
+int get_spi_flash_info(void) {
+    spi_flash_probe();
+    if (flash.name != NULL) {
+        dprintf(1, "Found SPI flash chip: %s (%02x %02x %02x), size: %d"
+                ", page: %d, read: %02x\n", flash.name, flash.id[0]
+                , flash.id[1], flash.id[2], flash.size, flash.page_size
+                , flash.read_opcode);
         return 1;
     } else {
         dprintf(1, "Could not find a SPI flash chip.\n");
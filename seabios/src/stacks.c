@@ -248,6 +248,11 @@ __call16_int(struct bregs *callregs, u16 offset)
 struct thread_info {
     void *stackpos;
     struct hlist_node node;
+    u32 wake;    // timer value to resume at when 'sleeping'
+    u8 sleeping;
+    // CONFIG_BOOT_PROFILE accounting
+    void *func;
+    u32 start, cpu, yields, resumed;
 };
 struct thread_info MainThread VARFSEG = {
     NULL, { &MainThread.node, &MainThread.node.next }
@@ -262,6 +267,20 @@ have_threads(void)
             && GET_FLATPTR(MainThread.node.next) != &MainThread.node);
 }
 
+// Check if any threads besides the main thread and the caller are running.
+int
+have_other_threads(void)
+{
+    if (!CONFIG_THREADS)
+        return 0;
+    struct thread_info *cur = getCurThread();
+    struct hlist_node *n;
+    for (n = MainThread.node.next; n != &MainThread.node; n = n->next)
+        if (n != &cur->node)
+            return 1;
+    return 0;
+}
+
 // Return the 'struct thread_info' for the currently running thread.
 struct thread_info *
 getCurThread(void)
@@ -290,15 +309,50 @@ threads_during_optionroms(void)
     return CONFIG_THREADS && ThreadControl == 2 && in_post();
 }
 
+// Threads in msleep() are skipped by the scheduler until their wake
+// time.  When all of them sleep the main thread halts until the next
+// irq instead of spinning - but only if the earliest wake time is at
+// least a timer irq period away, as nothing else would end the halt.
+#define THREAD_IDLE_MIN 55 // ms
+
+// Check if a thread should be scheduled.
+static int
+thread_ready(struct thread_info *t)
+{
+    return !t->sleeping || timer_check(t->wake);
+}
+
+// Check if all threads besides the main thread sleep past 'limit'.
+static int
+threads_idle(u32 limit)
+{
+    struct hlist_node *n;
+    for (n = MainThread.node.next; n != &MainThread.node; n = n->next) {
+        struct thread_info *t = container_of(n, struct thread_info, node);
+        if (!t->sleeping || (s32)(t->wake - limit) <= 0)
+            return 0;
+    }
+    return 1;
+}
+
 // Switch to next thread stack.
 static void
 switch_next(struct thread_info *cur)
 {
+    // The main thread is always run to give irqs a chance.
     struct thread_info *next = container_of(
         cur->node.next, struct thread_info, node);
+    while (next != &MainThread && next != cur && !thread_ready(next))
+        next = container_of(next->node.next, struct thread_info, node);
     if (cur == next)
         // Nothing to do.
         return;
+    if (CONFIG_BOOT_PROFILE) {
+        u32 now = timer_read();
+        cur->cpu += now - cur->resumed;
+        cur->yields++;
+        next->resumed = now;
+    }
     asm volatile(
         "  pushl $1f\n"                 // store return pc
         "  pushl %%ebp\n"               // backup %ebp
@@ -316,6 +370,14 @@ switch_next(struct thread_info *cur)
 static void
 __end_thread(struct thread_info *old)
 {
+    if (CONFIG_BOOT_PROFILE) {
+        u32 now = timer_read();
+        profile_thread(old->func, old->start, old->cpu + now - old->resumed
+                       , old->yields);
+        struct thread_info *next = container_of(
+            old->node.next, struct thread_info, node);
+        next->resumed = now;
+    }
     hlist_del(&old->node);
     dprintf(DEBUG_thread, "\\%08x/ End thread\n", (u32)old);
     free(old);
@@ -337,7 +399,17 @@ run_thread(void (*func)(void*), void *data)
 
     dprintf(DEBUG_thread, "/%08x\\ Start thread\n", (u32)thread);
     thread->stackpos = (void*)thread + THREADSTACKSIZE;
+    // The stack comes from malloc - start out runnable.
+    thread->sleeping = 0;
+    thread->wake = 0;
     struct thread_info *cur = getCurThread();
+    if (CONFIG_BOOT_PROFILE) {
+        u32 now = timer_read();
+        thread->func = func;
+        thread->start = thread->resumed = now;
+        thread->cpu = thread->yields = 0;
+        cur->cpu += now - cur->resumed;
+    }
     hlist_add_after(&thread->node, &cur->node);
     asm volatile(
         // Start thread
@@ -421,7 +493,7 @@ yield_toirq(void)
         wait_irq();
         return;
     }
-    if (have_threads()) {
+    if (have_threads() && !threads_idle(timer_calc(THREAD_IDLE_MIN))) {
         // Threads still active - do a yield instead.
         yield();
         return;
@@ -430,13 +502,39 @@ yield_toirq(void)
     call16big(0, 0, _cfunc16_wait_irq);
 }
 
+// Yield until the timer reaches 'end' - used by msleep().
+void
+yield_until(u32 end)
+{
+    if (MODESEGMENT || !CONFIG_THREADS) {
+        yield();
+        return;
+    }
+    struct thread_info *cur = getCurThread();
+    if (cur == &MainThread) {
+        u32 limit = timer_calc(THREAD_IDLE_MIN);
+        if ((s32)(end - limit) > 0 && threads_idle(limit)) {
+            // Nothing to do until the next irq.
+            extern void _cfunc16_wait_irq(void);
+            call16big(0, 0, _cfunc16_wait_irq);
+            return;
+        }
+        yield();
+        return;
+    }
+    cur->wake = end;
+    cur->sleeping = 1;
+    yield();
+    cur->sleeping = 0;
+}
+
 // Wait for all threads (other than the main thread) to complete.
 void
 wait_threads(void)
 {
     ASSERT32FLAT();
     while (have_threads())
-        yield();
+        yield_toirq();
 }
 
 void
@@ -26,12 +26,20 @@ struct bios_settings {
     int com1_clock_ratio_index; // 0 = 1/16, 1 = 1/8. Only valid when clock_index = 48 MHz
     int com2_clock_index;       // 0 = 1.8432 MHz, 1 = 24 MHz, 2 = 48 MHz
     int com2_clock_ratio_index; // 0 = 1/16, 1 = 1/8. Only valid when clock_index = 48 MHz
+    int disk_write_cache;
     // int isa_freq_index;         // 0 = 8.33 MHz, 1 = 16.67 MHz
 };
 u32 get_current_cpu_freq(void);
 void load_bios_settings(struct bios_settings *s);
 void bios_setup_main(struct bios_settings *s);
 void load_custom_fonts(u8 *font_ptr, u16 ascii_position, u16 count);
+void presence_load(void);
+int presence_ata(int chanid, int slave);
+void presence_ata_found(int chanid, int slave);
+int presence_usb(u16 bdf, int port);
+void presence_usb_found(u16 bdf, int port);
+void presence_rescan(void);
+void presence_save(void);
 
 // spi_flash.c
 extern const u32 spi_page_size;
@@ -40,12 +48,15 @@ extern const u32 spi_crossbar_offset;
 extern const u32 spi_bios_settings_offset;
 int get_spi_flash_info(void);
 u8 spi_flash_read_byte(u32);
+void spi_flash_read(u32, u8 *, u32);
+void spi_flash_read_mapped(u32, u8 *, u32);
 void spi_flash_write_byte(u32, u8);
-void spi_flash_erase_sector(u32);
+int spi_flash_program_page(u32, const u8 *, u32);
+int spi_flash_erase_sector(u32);
 
 // speaker.c
-void play_ducks_tune(void);
-void play_mushroom_tune(void);
+void play_boot_tune(int tune);
+void stop_boot_tune(void);
 
 // apm.c
 void apm_shutdown(void);
@@ -68,6 +79,8 @@ void boot_add_floppy(struct drive_s *drive_g, const char *desc, int prio);
 void boot_add_hd(struct drive_s *drive_g, const char *desc, int prio);
 void boot_add_cd(struct drive_s *drive_g, const char *desc, int prio);
 void boot_add_cbfs(void *data, const char *desc, int prio);
+int boot_probe_abandoned(void);
+void boot_wait_probes(void);
 void interactive_bootmenu(void);
 void bcv_prepboot(void);
 struct pci_device;
@@ -132,6 +145,22 @@ void coreboot_platform_setup(void);
 void cbfs_payload_setup(void);
 void coreboot_preinit(void);
 void coreboot_cbfs_init(void);
+void coreboot_timestamp(u32 id);
+// Boot phase ids for coreboot_timestamp() - keep in sync with
+// coreboot's timestamp.h.
+#define TS_SEABIOS_START            1000
+#define TS_SEABIOS_CBFS_INIT        1001
+#define TS_SEABIOS_DEVICE_SETUP     1002
+#define TS_SEABIOS_START_RAMDISK    1003
+#define TS_SEABIOS_END_RAMDISK      1004
+#define TS_SEABIOS_DEVICES_DONE     1005
+#define TS_SEABIOS_START_OPTIONROMS 1006
+#define TS_SEABIOS_END_OPTIONROMS   1007
+#define TS_SEABIOS_START_BOOTMENU   1008
+#define TS_SEABIOS_END_BOOTMENU     1009
+#define TS_SEABIOS_BOOT             1010
+struct romfile_s;
+void *cbfs_romfile_data(struct romfile_s *file, u32 *rawsize, int *islzma);
 struct cb_header;
 void *find_cb_subtable(struct cb_header *cbh, u32 tag);
 struct cb_header *find_cb_table(void);
@@ -192,6 +221,7 @@ int process_ramdisk_op(struct disk_op_s *op);
 // hw/timer.c
 void timer_setup(void);
 void pmtimer_setup(u16 ioport);
+u32 timer_read(void);
 u32 timer_calc(u32 msecs);
 u32 timer_calc_usec(u32 usecs);
 int timer_check(u32 end);
@@ -257,6 +287,13 @@ void prepareboot(void);
 void startBoot(void);
 void reloc_preinit(void *f, void *arg);
 
+// profile.c
+void profile_init(void);
+u32 profile_start(void);
+void profile_phase(const char *name, u32 start);
+void profile_thread(void *func, u32 start, u32 cpu, u32 yields);
+void profile_dump(void);
+
 // resume.c
 extern int HaveRunPost;
 